@@ -0,0 +1,125 @@
+#!/usr/bin/env bash
+# パイプライン変更の前後比較用の計測（Jetson上で、アプリ起動中に実行する）。
+#
+#   scripts/measure_pipeline.sh <ラベル> [秒数]   計測して結果をCSVに追記
+#   scripts/measure_pipeline.sh clock             遅延計測用のミリ秒時計を表示
+#
+# 計測するもの:
+#   - アプリのプロセスCPU使用率（/proc/<pid>/stat、100% = 1コア）とシステム全体のCPU使用率
+#   - tegrastatsがあればGPU（GR3D）使用率と使用メモリの平均
+#   - /stream の受信fpsとフレーム到着間隔（p50/p99）。1クライアントで受信する
+#   - /api/detections の応答時間（p50/p99）
+# カメラからブラウザまでの遅延（glass-to-glass）は自動では測れないので、
+# clock をカメラに映し、時計とプレビューを一緒に撮影して差を読む（README参照）
+set -euo pipefail
+
+APP_HTTP_PORT=${APP_HTTP_PORT:-8080}
+HOST=${HOST:-127.0.0.1}
+BASE_URL="http://${HOST}:${APP_HTTP_PORT}"
+RESULTS=${RESULTS:-measurements.csv}
+APP_PATTERN=${APP_PATTERN:-build/edge-room-monitor}
+
+info() { printf '[measure] %s\n' "$*"; }
+err()  { printf '[measure ERROR] %s\n' "$*" >&2; }
+
+if [[ "${1:-}" == "clock" ]]; then
+  # 画面に大きく映す。表示の更新は端末次第なので、複数回撮影して最小値を取る
+  while :; do
+    printf '\r%s   ' "$(date +%H:%M:%S.%3N)"
+    sleep 0.005
+  done
+fi
+
+LABEL=${1:?"ラベル（例: before / after）を指定してください"}
+SECONDS_TO_RUN=${2:-30}
+
+command -v python3 >/dev/null 2>&1 || { err "python3 が必要です"; exit 1; }
+command -v curl >/dev/null 2>&1 || { err "curl が必要です"; exit 1; }
+
+PID=$(pgrep -f "$APP_PATTERN" | head -n1 || true)
+if [[ -z "$PID" ]]; then
+  err "アプリのプロセス（${APP_PATTERN}）が見つかりません"
+  exit 1
+fi
+CLK_TCK=$(getconf CLK_TCK)
+
+proc_ticks() { awk '{print $14 + $15}' "/proc/$PID/stat"; }
+system_ticks() { awk '/^cpu /{idle = $5 + $6; total = 0; for (i = 2; i <= NF; i++) total += $i; print total, idle}' /proc/stat; }
+
+TMP=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null || true; rm -rf "$TMP"' EXIT
+
+if command -v tegrastats >/dev/null 2>&1; then
+  tegrastats --interval 1000 >"$TMP/tegrastats.log" 2>/dev/null &
+fi
+
+# /stream を1クライアントで受信し、各フレームの到着時刻を記録する
+python3 - "$BASE_URL/stream" "$SECONDS_TO_RUN" >"$TMP/stream.txt" <<'EOF' &
+import socket, sys, time, urllib.parse
+url = urllib.parse.urlparse(sys.argv[1])
+duration = float(sys.argv[2])
+sock = socket.create_connection((url.hostname, url.port or 80), timeout=5)
+sock.sendall(f"GET {url.path} HTTP/1.1\r\nHost: {url.hostname}\r\n\r\n".encode())
+boundary = b"--frame\r\n"
+tail = b""
+arrivals = []
+deadline = time.monotonic() + duration
+while time.monotonic() < deadline:
+    data = sock.recv(256 * 1024)
+    if not data:
+        break
+    window = tail + data
+    now = time.monotonic()
+    arrivals.extend([now] * window.count(boundary))
+    tail = window[-(len(boundary) - 1):]
+intervals = sorted((b - a) * 1000 for a, b in zip(arrivals[1:], arrivals[2:]))
+if intervals:
+    fps = (len(arrivals) - 2) / (arrivals[-1] - arrivals[1]) if len(arrivals) > 2 else 0
+    p = lambda q: intervals[min(len(intervals) - 1, int(q * len(intervals)))]
+    print(f"{fps:.1f} {p(0.5):.1f} {p(0.99):.1f}")
+else:
+    print("0 0 0")
+EOF
+STREAM_JOB=$!
+
+info "${SECONDS_TO_RUN}秒間計測します（pid ${PID}, ${BASE_URL}）"
+proc_start=$(proc_ticks)
+read -r sys_total_start sys_idle_start < <(system_ticks)
+api_times=()
+end=$((SECONDS + SECONDS_TO_RUN))
+while ((SECONDS < end)); do
+  api_times+=("$(curl -s -o /dev/null -w '%{time_total}' "$BASE_URL/api/detections")")
+  sleep 0.2
+done
+proc_end=$(proc_ticks)
+read -r sys_total_end sys_idle_end < <(system_ticks)
+wait "$STREAM_JOB" || true
+
+proc_cpu=$(awk -v t="$((proc_end - proc_start))" -v hz="$CLK_TCK" -v s="$SECONDS_TO_RUN" \
+  'BEGIN { printf "%.1f", 100 * t / hz / s }')
+sys_cpu=$(awk -v t="$((sys_total_end - sys_total_start))" -v i="$((sys_idle_end - sys_idle_start))" \
+  'BEGIN { printf "%.1f", (t > 0 ? 100 * (t - i) / t : 0) }')
+read -r stream_fps stream_p50 stream_p99 <"$TMP/stream.txt"
+read -r api_p50 api_p99 < <(printf '%s\n' "${api_times[@]}" | sort -n | awk '
+  { v[NR] = $1 * 1000 }
+  END { i50 = int(NR * 0.5) + 1; i99 = int(NR * 0.99) + 1; if (i99 > NR) i99 = NR
+        printf "%.1f %.1f\n", v[i50], v[i99] }')
+
+gpu="-"
+ram="-"
+if [[ -s "$TMP/tegrastats.log" ]]; then
+  gpu=$(grep -o 'GR3D_FREQ [0-9]*%' "$TMP/tegrastats.log" | tr -dc '0-9\n' |
+    awk '{ s += $1; n++ } END { if (n) printf "%.0f", s / n; else print "-" }')
+  ram=$(grep -o 'RAM [0-9]*/' "$TMP/tegrastats.log" | tr -dc '0-9\n' |
+    awk '{ s += $1; n++ } END { if (n) printf "%.0f", s / n; else print "-" }')
+fi
+
+if [[ ! -f "$RESULTS" ]]; then
+  echo "label,seconds,app_cpu_pct,system_cpu_pct,gpu_pct,ram_mb,stream_fps,frame_interval_p50_ms,frame_interval_p99_ms,api_p50_ms,api_p99_ms" >"$RESULTS"
+fi
+echo "${LABEL},${SECONDS_TO_RUN},${proc_cpu},${sys_cpu},${gpu},${ram},${stream_fps},${stream_p50},${stream_p99},${api_p50},${api_p99}" >>"$RESULTS"
+
+info "アプリCPU ${proc_cpu}%（1コア=100%）、システムCPU ${sys_cpu}%、GPU ${gpu}%、RAM ${ram}MB"
+info "/stream ${stream_fps}fps、フレーム間隔 p50 ${stream_p50}ms / p99 ${stream_p99}ms"
+info "/api/detections p50 ${api_p50}ms / p99 ${api_p99}ms"
+info "${RESULTS} に追記しました"
@@ -1,33 +1,51 @@
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <gst/app/gstappsink.h>
 #include <gst/gst.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <zlib.h>
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cerrno>
 #include <chrono>
 #include <cmath>
+#include <cstdio>
 #include <csignal>
 #include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <random>
 #include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 // DeepStream headers
+#include "gstnvdsinfer.h"
 #include "gstnvdsmeta.h"
 
 #ifndef MSG_NOSIGNAL
@@ -52,6 +70,290 @@ struct Detection {
   float height;
 };
 
+// 検出座標系（nvstreammuxの出力解像度）。プレビューJPEGと異なる場合はUI側で拡大縮小する
+struct FrameSize {
+  int width = 0;
+  int height = 0;
+};
+
+// メタデータから取り出した1フレーム分の検出結果
+struct FrameDetections {
+  std::vector<Detection> detections;
+  FrameSize frame_size;
+  GstClockTime pts = GST_CLOCK_TIME_NONE;  // カメラバッファのPTS（JPEGとの対応付け用）
+};
+
+// 再利用できるバッファに書き込むJSONライタ。
+// ostringstreamと違ってロケールに依存せず、clear()後はバッファを使い回すので
+// 毎フレームの直列化で確保が起きない。カンマは自動で入る。
+class JsonWriter {
+ public:
+  static constexpr int kFloatDecimals = 3;
+
+  void clear() {
+    buffer_.clear();
+    first_ = true;
+    after_key_ = false;
+  }
+
+  const std::string &str() const { return buffer_; }
+
+  JsonWriter &begin_object() {
+    separate();
+    buffer_ += '{';
+    first_ = true;
+    return *this;
+  }
+
+  JsonWriter &end_object() {
+    buffer_ += '}';
+    first_ = false;
+    return *this;
+  }
+
+  JsonWriter &begin_array() {
+    separate();
+    buffer_ += '[';
+    first_ = true;
+    return *this;
+  }
+
+  JsonWriter &end_array() {
+    buffer_ += ']';
+    first_ = false;
+    return *this;
+  }
+
+  JsonWriter &key(std::string_view name) {
+    separate();
+    write_string(name);
+    buffer_ += ':';
+    after_key_ = true;
+    return *this;
+  }
+
+  JsonWriter &value(std::string_view text) {
+    separate();
+    write_string(text);
+    return *this;
+  }
+
+  JsonWriter &value(const char *text) { return value(std::string_view(text)); }
+
+  JsonWriter &value(bool flag) {
+    separate();
+    buffer_ += flag ? "true" : "false";
+    return *this;
+  }
+
+  JsonWriter &value(int number) { return value(static_cast<int64_t>(number)); }
+
+  JsonWriter &value(int64_t number) {
+    separate();
+    if (number < 0) {
+      buffer_ += '-';
+      write_unsigned(0 - static_cast<uint64_t>(number));
+    } else {
+      write_unsigned(static_cast<uint64_t>(number));
+    }
+    return *this;
+  }
+
+  JsonWriter &value(uint64_t number) {
+    separate();
+    write_unsigned(number);
+    return *this;
+  }
+
+  // 小数点以下kFloatDecimals桁に丸め、末尾の0は省く（bboxと信頼度には十分）
+  JsonWriter &value(double number) {
+    separate();
+    if (!std::isfinite(number)) {
+      buffer_ += '0';  // JSONにNaN/Infはない
+      return *this;
+    }
+    const double magnitude = std::fabs(number);
+    if (magnitude >= 1e15) {
+      // 小数部はほぼ表せないので整数に丸めて書く。uint64を超える値は飽和させる
+      const double whole = std::round(magnitude);
+      if (number < 0) {
+        buffer_ += '-';
+      }
+      write_unsigned(whole < 18446744073709551616.0 ? static_cast<uint64_t>(whole) : UINT64_MAX);
+      return *this;
+    }
+    uint64_t scale = 1;
+    for (int i = 0; i < kFloatDecimals; ++i) {
+      scale *= 10;
+    }
+    const auto scaled = static_cast<uint64_t>(std::llround(magnitude * static_cast<double>(scale)));
+    if (number < 0 && scaled != 0) {
+      buffer_ += '-';
+    }
+    write_unsigned(scaled / scale);
+    uint64_t fraction = scaled % scale;
+    if (fraction == 0) {
+      return *this;
+    }
+    int digits = kFloatDecimals;
+    while (fraction % 10 == 0) {
+      fraction /= 10;
+      --digits;
+    }
+    buffer_ += '.';
+    char text[kFloatDecimals];
+    for (int i = digits - 1; i >= 0; --i) {
+      text[i] = static_cast<char>('0' + fraction % 10);
+      fraction /= 10;
+    }
+    buffer_.append(text, static_cast<size_t>(digits));
+    return *this;
+  }
+
+  JsonWriter &value(float number) { return value(static_cast<double>(number)); }
+
+ private:
+  void separate() {
+    if (after_key_) {
+      after_key_ = false;
+      return;
+    }
+    if (!first_) {
+      buffer_ += ',';
+    }
+    first_ = false;
+  }
+
+  void write_unsigned(uint64_t number) {
+    char text[20];
+    int pos = sizeof(text);
+    do {
+      text[--pos] = static_cast<char>('0' + number % 10);
+      number /= 10;
+    } while (number != 0);
+    buffer_.append(text + pos, sizeof(text) - static_cast<size_t>(pos));
+  }
+
+  void write_string(std::string_view text) {
+    static const char kHex[] = "0123456789abcdef";
+    buffer_ += '"';
+    size_t run = 0;  // エスケープ不要な区間はまとめて追加する
+    for (size_t i = 0; i < text.size(); ++i) {
+      const auto c = static_cast<unsigned char>(text[i]);
+      if (c >= 0x20 && c != '"' && c != '\\') {
+        continue;
+      }
+      buffer_.append(text.data() + run, i - run);
+      run = i + 1;
+      buffer_ += '\\';
+      switch (c) {
+        case '"': buffer_ += '"'; break;
+        case '\\': buffer_ += '\\'; break;
+        case '\n': buffer_ += 'n'; break;
+        case '\r': buffer_ += 'r'; break;
+        case '\t': buffer_ += 't'; break;
+        case '\b': buffer_ += 'b'; break;
+        case '\f': buffer_ += 'f'; break;
+        default:
+          buffer_ += "u00";
+          buffer_ += kHex[c >> 4];
+          buffer_ += kHex[c & 0xf];
+          break;
+      }
+    }
+    buffer_.append(text.data() + run, text.size() - run);
+    buffer_ += '"';
+  }
+
+  std::string buffer_;
+  bool first_ = true;
+  bool after_key_ = false;
+};
+
+// メタデータ取得スレッド（appsink）から解析スレッドへ検出結果を渡す
+// 単一生産者・単一消費者のリング。スロットのvectorは使い回すので定常状態では確保しない。
+// 満杯なら新しいフレームを捨てて overruns に数える（appsinkは待たせない）
+class DetectionRing {
+ public:
+  static constexpr size_t kCapacity = 8;  // 2のべき乗
+
+  DetectionRing() : event_fd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    for (auto &slot : slots_) {
+      slot.detections.reserve(32);
+    }
+  }
+
+  ~DetectionRing() {
+    if (event_fd_ >= 0) {
+      ::close(event_fd_);
+    }
+  }
+
+  DetectionRing(const DetectionRing &) = delete;
+  DetectionRing &operator=(const DetectionRing &) = delete;
+
+  // 生産者: 書き込み先のスロット。満杯ならnullptr
+  FrameDetections *begin_push() {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= kCapacity) {
+      overruns_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    return &slots_[head & (kCapacity - 1)];
+  }
+
+  void commit_push() {
+    const uint64_t head = head_.load(std::memory_order_relaxed) + 1;
+    head_.store(head, std::memory_order_release);
+    const uint64_t occupancy = head - tail_.load(std::memory_order_acquire);
+    if (occupancy > occupancy_max_.load(std::memory_order_relaxed)) {
+      occupancy_max_.store(occupancy, std::memory_order_relaxed);
+    }
+    const uint64_t one = 1;
+    ssize_t ret = ::write(event_fd_, &one, sizeof(one));
+    (void)ret;
+  }
+
+  // 消費者: 先頭のフレーム。空ならtimeout_msまで待ち、それでも空ならnullptr
+  FrameDetections *front(int timeout_ms) {
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if (head_.load(std::memory_order_acquire) == tail) {
+      pollfd pfd {event_fd_, POLLIN, 0};
+      ::poll(&pfd, 1, timeout_ms);
+      uint64_t counter;
+      while (::read(event_fd_, &counter, sizeof(counter)) > 0) {
+      }
+      if (head_.load(std::memory_order_acquire) == tail) {
+        return nullptr;
+      }
+    }
+    return &slots_[tail & (kCapacity - 1)];
+  }
+
+  void pop() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // 開いているオブジェクトに統計のキーを書き足す
+  void write_stats(JsonWriter &json) const {
+    const uint64_t tail = tail_.load(std::memory_order_acquire);
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    json.key("capacity").value(static_cast<uint64_t>(kCapacity))
+        .key("occupancy").value(head - tail)
+        .key("occupancy_max").value(occupancy_max_.load(std::memory_order_relaxed))
+        .key("frames").value(head)
+        .key("overruns").value(overruns_.load(std::memory_order_relaxed));
+  }
+
+ private:
+  std::array<FrameDetections, kCapacity> slots_;
+  int event_fd_ = -1;  // 空のリングで消費者を待たせる
+  alignas(64) std::atomic<uint64_t> head_{0};  // 生産者だけが進める
+  alignas(64) std::atomic<uint64_t> tail_{0};  // 消費者だけが進める
+  alignas(64) std::atomic<uint64_t> overruns_{0};
+  std::atomic<uint64_t> occupancy_max_{0};
+};
+
 enum AlertType {
   ALERT_NONE = 0,
   ALERT_FALL = 1,           // 転倒
@@ -61,41 +363,177 @@ enum AlertType {
   ALERT_FRAME_OUT = 5       // フレームアウト（徘徊の可能性）
 };
 
+constexpr int kAlertTypeCount = ALERT_FRAME_OUT + 1;
+
 struct Alert {
+  uint64_t id;  // 単調増加のアラートID（クリップ取得などに使用）
   int fixed_id;
   AlertType type;
   std::chrono::steady_clock::time_point timestamp;
   std::string message;
   bool acknowledged;  // 確認済みフラグ
+  uint64_t version = 0;  // 追加・確認したときのアラート一覧の版（/api/alerts?since=）
 };
 
-struct RegisteredPerson {
-  int fixed_id;  // 固定ID (0-3)
-  uint64_t current_nvtracker_id;  // 現在のnvtracker ID
-  float bbox_width;
-  float bbox_height;
-  float bbox_left;
-  float bbox_top;
+// 追跡中の人物の姿勢判定の状態（状態が変わるときにだけ書き換える値）
+struct PersonState {
   float stable_bbox_top;  // 安定時の頭の位置（Y座標）
   float stable_bbox_height;  // 安定時の高さ（立っている時）
   float sitting_bbox_height;  // 座っている時の高さ
-  float prev_bbox_top;  // 前フレームの頭位置（転倒検知用）
-  float prev_bbox_height;  // 前フレームの高さ（転倒検知用）
   float lying_bbox_top;  // 横たわり開始時のY座標（ベッド落下検知用）
-  std::chrono::steady_clock::time_point last_seen;
   std::chrono::steady_clock::time_point lying_start;
   std::chrono::steady_clock::time_point lying_stable;  // 横たわり状態が安定した時刻
   std::chrono::steady_clock::time_point standing_confirmed;  // 立っている状態が確定した時刻
   std::chrono::steady_clock::time_point sitting_confirmed;  // 座っている状態が確定した時刻
   std::chrono::steady_clock::time_point head_position_recorded;  // 頭の位置を記録した時刻
-  std::chrono::steady_clock::time_point last_update;  // 最後に更新した時刻（転倒検知用）
-  int frame_count;  // フレームカウント
-  bool active;  // 追跡中かどうか
   bool is_lying;  // 横たわっているか
   bool is_sitting;  // 座っているか
   bool was_standing;  // 前は立っていたか（確定状態）
 };
 
+// 追跡中の人物の表。スロット番号がそのまま固定IDになる。
+// 毎フレーム読み書きするbbox・前フレームのbbox・カウンタは項目ごとの配列（SoA）で持ち、
+// nvtracker ID→スロットはハッシュで引くので、1フレームの処理は検出数に比例する
+struct PersonTable {
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  explicit PersonTable(int capacity)
+      : tracking_id(capacity), bbox_left(capacity), bbox_top(capacity),
+        bbox_width(capacity), bbox_height(capacity), prev_bbox_top(capacity),
+        prev_bbox_height(capacity), frame_count(capacity), seen_update(capacity),
+        last_seen(capacity), last_update(capacity), state(capacity),
+        active_pos_(capacity, -1) {
+    index_.reserve(static_cast<size_t>(capacity) * 2);
+    clear();
+  }
+
+  int capacity() const { return static_cast<int>(state.size()); }
+
+  // 追跡中ならスロット、そうでなければ-1
+  int find(uint64_t id) const {
+    const auto it = index_.find(id);
+    return it == index_.end() ? -1 : it->second;
+  }
+
+  bool is_active(int slot) const {
+    return slot >= 0 && slot < capacity() && active_pos_[slot] >= 0;
+  }
+
+  // 追跡中のスロット（順不同）
+  const std::vector<int> &active() const { return active_; }
+
+  // 空いている最小のスロットを割り当てる。満員なら-1
+  int acquire(uint64_t id) {
+    if (free_.empty()) {
+      return -1;
+    }
+    const int slot = free_.back();
+    free_.pop_back();
+    tracking_id[slot] = id;
+    index_[id] = slot;
+    active_pos_[slot] = static_cast<int>(active_.size());
+    active_.push_back(slot);
+    return slot;
+  }
+
+  void release(int slot) {
+    index_.erase(tracking_id[slot]);
+    const int pos = active_pos_[slot];
+    active_pos_[active_.back()] = pos;
+    active_[pos] = active_.back();
+    active_.pop_back();
+    active_pos_[slot] = -1;
+    // 降順を保って戻す（末尾が最小の空き）
+    free_.insert(std::upper_bound(free_.begin(), free_.end(), slot, std::greater<int>()),
+                 slot);
+  }
+
+  void clear() {
+    index_.clear();
+    active_.clear();
+    std::fill(active_pos_.begin(), active_pos_.end(), -1);
+    free_.clear();
+    for (int slot = capacity() - 1; slot >= 0; --slot) {
+      free_.push_back(slot);
+    }
+  }
+
+  // hot: 毎フレーム触る
+  std::vector<uint64_t> tracking_id;  // 現在のnvtracker ID
+  std::vector<float> bbox_left;
+  std::vector<float> bbox_top;
+  std::vector<float> bbox_width;
+  std::vector<float> bbox_height;
+  std::vector<float> prev_bbox_top;  // 前フレームの頭位置（転倒検知用）
+  std::vector<float> prev_bbox_height;  // 前フレームの高さ（転倒検知用）
+  std::vector<int> frame_count;  // フレームカウント
+  std::vector<uint64_t> seen_update;  // 最後に検出と対応付いたupdate()の番号
+  std::vector<TimePoint> last_seen;
+  std::vector<TimePoint> last_update;  // 最後に更新した時刻（転倒検知用）
+  // cold: 姿勢が変わるときに触る
+  std::vector<PersonState> state;
+
+ private:
+  std::unordered_map<uint64_t, int> index_;  // nvtracker ID → スロット
+  std::vector<int> active_;
+  std::vector<int> active_pos_;  // スロット → active_内の位置（-1 = 空き）
+  std::vector<int> free_;  // 空きスロット（降順）
+};
+
+// 直近のアラートを古い順に持つ固定長のリング。満杯なら最も古いものを上書きする。
+// IDは連番で振るので、IDからリング上の位置を直接求められる
+class AlertLog {
+ public:
+  static constexpr size_t kDefaultCapacity = 256;
+
+  explicit AlertLog(size_t capacity = kDefaultCapacity)
+      : slots_(std::max<size_t>(capacity, 1)) {}
+
+  // IDを振って追加する
+  Alert &push(Alert alert) {
+    alert.id = next_id_++;
+    Alert &slot = slots_[alert.id % slots_.size()];
+    slot = std::move(alert);
+    if (size_ < slots_.size()) {
+      ++size_;
+    }
+    return slot;
+  }
+
+  // 保持していなければ（上書き・クリア済み）nullptr
+  Alert *find(uint64_t id) {
+    if (id >= next_id_ || next_id_ - id > size_) {
+      return nullptr;
+    }
+    return &slots_[id % slots_.size()];
+  }
+
+  // 古い順に呼ぶ
+  template <typename F>
+  void for_each(F &&f) {
+    for (uint64_t id = next_id_ - size_; id < next_id_; ++id) {
+      f(slots_[id % slots_.size()]);
+    }
+  }
+
+  std::vector<Alert> to_vector() const {
+    std::vector<Alert> alerts;
+    alerts.reserve(size_);
+    for (uint64_t id = next_id_ - size_; id < next_id_; ++id) {
+      alerts.push_back(slots_[id % slots_.size()]);
+    }
+    return alerts;
+  }
+
+  // IDは振り直さない（クリア前のIDで確認されても別のアラートに当たらない）
+  void clear() { size_ = 0; }
+
+ private:
+  std::vector<Alert> slots_;
+  size_t size_ = 0;
+  uint64_t next_id_ = 1;
+};
+
 
 
 std::string load_pipeline_description(const std::string &path) {
@@ -140,326 +578,539 @@ uint16_t resolve_port(const char *env) {
   return static_cast<uint16_t>(v);
 }
 
+int env_int(const char *name, int default_value) {
+  const char *env = std::getenv(name);
+  if (!env || *env == '\0') {
+    return default_value;
+  }
+  return std::atoi(env);
+}
+
+// appsinkから受け取ったJPEGフレーム。GstBufferの参照とmapを保持し、
+// 最後の参照が外れた時点でunmap/unrefする
+class JpegFrame {
+ public:
+  static std::shared_ptr<const JpegFrame> wrap(GstBuffer *buffer) {
+    if (!buffer) {
+      return nullptr;
+    }
+    // v4l2srcなどのバッファプール由来のバッファは数が限られており、
+    // 遅いクライアントが保持し続けるとカメラが止まるため、その場合だけ一度コピーする
+    GstBuffer *owned =
+        buffer->pool ? gst_buffer_copy_deep(buffer) : gst_buffer_ref(buffer);
+    if (!owned) {
+      return nullptr;
+    }
+    std::shared_ptr<JpegFrame> frame(new JpegFrame(owned));
+    if (!gst_buffer_map(frame->buffer_, &frame->map_, GST_MAP_READ)) {
+      return nullptr;
+    }
+    frame->mapped_ = true;
+    if (frame->map_.size == 0) {
+      return nullptr;
+    }
+    return frame;
+  }
+
+  ~JpegFrame() {
+    if (mapped_) {
+      gst_buffer_unmap(buffer_, &map_);
+    }
+    gst_buffer_unref(buffer_);
+  }
+
+  JpegFrame(const JpegFrame &) = delete;
+  JpegFrame &operator=(const JpegFrame &) = delete;
+
+  const uint8_t *data() const { return map_.data; }
+  size_t size() const { return map_.size; }
+  GstClockTime pts() const { return pts_; }
+
+ private:
+  explicit JpegFrame(GstBuffer *buffer)
+      : buffer_(buffer), map_(), pts_(GST_BUFFER_PTS(buffer)) {}
+
+  GstBuffer *buffer_;
+  GstMapInfo map_;
+  GstClockTime pts_;
+  bool mapped_ = false;
+};
+
+using JpegFramePtr = std::shared_ptr<const JpegFrame>;
+
+// /stream?meta=1 用: JPEGとそのフレームの検出結果（JSON）の組
+struct AnnotatedFrame {
+  JpegFramePtr frame;
+  uint64_t sequence;  // FrameStoreのフレーム番号
+  std::string json;
+};
+
+using AnnotatedFramePtr = std::shared_ptr<const AnnotatedFrame>;
+
 class FrameStore {
  public:
-  void update(const guint8 *data, gsize size) {
-    if (!data || size == 0) {
+  void update(JpegFramePtr frame) {
+    if (!frame) {
       return;
     }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++sequence_;
+      // 検出結果との突き合わせ用に直近のフレームを残しておく
+      if (meta_viewers_ > 0) {
+        History &slot = history_[sequence_ % kHistorySize];
+        slot.frame = frame;
+        slot.sequence = sequence_;
+      }
+      frame_.swap(frame);
+    }
+    notify();
+    // 古いフレームの解放（unmap/unref）はロック外で行う
+  }
+
+  JpegFramePtr latest(uint64_t &sequence) const {
     std::lock_guard<std::mutex> lock(mutex_);
-    frame_.assign(data, data + size);
-    ++sequence_;
-    cond_.notify_all();
+    sequence = sequence_;
+    return frame_;
   }
 
-  bool wait_for_frame(uint64_t &cursor, std::vector<uint8_t> &out) {
-    std::unique_lock<std::mutex> lock(mutex_);
-    cond_.wait(lock, [&] { return sequence_ != cursor || !g_running.load(); });
-    if (!g_running.load() && sequence_ == cursor) {
-      return false;
+  // meta=1の視聴者がいる時だけ検出結果をJSON化すればよい
+  bool wants_meta() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return meta_viewers_ > 0;
+  }
+
+  // PTSが一致する直近のJPEGに検出結果を紐付けて公開する。
+  // 推論ブランチはプレビューより遅れるので、JPEGは履歴から探す
+  bool annotate(GstClockTime pts,
+                const std::function<std::string(uint64_t)> &to_json) {
+    JpegFramePtr frame;
+    uint64_t sequence = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const History &slot : history_) {
+        if (slot.frame && slot.frame->pts() == pts) {
+          frame = slot.frame;
+          sequence = slot.sequence;
+          break;
+        }
+      }
+      if (!frame || sequence <= annotated_sequence_) {
+        return false;  // プレビュー側で落ちたフレーム、または古い結果
+      }
+    }
+    auto annotated = std::make_shared<AnnotatedFrame>();
+    annotated->frame = std::move(frame);
+    annotated->sequence = sequence;
+    annotated->json = to_json(sequence);
+    AnnotatedFramePtr previous = annotated;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (sequence <= annotated_sequence_) {
+        return false;
+      }
+      annotated_.swap(previous);
+      annotated_sequence_ = sequence;
+    }
+    notify();
+    return true;
+  }
+
+  AnnotatedFramePtr latest_annotated(uint64_t &sequence) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sequence = annotated_sequence_;
+    return annotated_;
+  }
+
+  // 新しいフレームが来るたびにeventfdへ書き込む（epollループ用）
+  void set_notify_fd(int fd) { notify_fd_.store(fd); }
+
+  // 視聴者数が0⇔1になった時に呼ばれる（プレビューブランチのvalve切り替え用）
+  void set_viewer_callback(std::function<void(bool)> callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    viewer_callback_ = std::move(callback);
+  }
+
+  // コールバックは順序が入れ替わらないようロック内で呼ぶ（valveの切り替えのみ）
+  void add_viewer(bool with_meta) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (with_meta) {
+      ++meta_viewers_;
+    }
+    if (viewers_++ == 0 && viewer_callback_) {
+      viewer_callback_(true);
+    }
+  }
+
+  void remove_viewer(bool with_meta) {
+    JpegFramePtr stale;
+    AnnotatedFramePtr stale_annotated;
+    std::array<History, kHistorySize> stale_history;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (with_meta && meta_viewers_ > 0 && --meta_viewers_ == 0) {
+      stale_history.swap(history_);
     }
-    out = frame_;
-    cursor = sequence_;
-    return !frame_.empty();
+    if (viewers_ == 0 || --viewers_ != 0) {
+      return;
+    }
+    // 誰も見ていない間はフレームが止まるので、次の視聴者に古い画像を見せない
+    stale.swap(frame_);
+    stale_annotated.swap(annotated_);
+    if (viewer_callback_) {
+      viewer_callback_(false);
+    }
+  }
+
+  int viewers() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return viewers_;
   }
 
  private:
-  std::mutex mutex_;
-  std::condition_variable cond_;
-  std::vector<uint8_t> frame_;
+  static constexpr size_t kHistorySize = 8;  // 30fpsで約260ms分
+
+  struct History {
+    JpegFramePtr frame;
+    uint64_t sequence = 0;
+  };
+
+  void notify() {
+    const int fd = notify_fd_.load();
+    if (fd >= 0) {
+      const uint64_t one = 1;
+      ssize_t ret = ::write(fd, &one, sizeof(one));
+      (void)ret;
+    }
+  }
+
+  mutable std::mutex mutex_;
+  JpegFramePtr frame_;
   uint64_t sequence_{0};
+  std::array<History, kHistorySize> history_;
+  AnnotatedFramePtr annotated_;
+  uint64_t annotated_sequence_{0};
+  std::atomic<int> notify_fd_{-1};
+  int viewers_ = 0;
+  int meta_viewers_ = 0;
+  std::function<void(bool)> viewer_callback_;
 };
 
 class DetectionStore {
  public:
-  static constexpr int MAX_REGISTERED_PERSONS = 4;  // 最大4人（Jetson Nano性能考慮）
+  static constexpr int kDefaultMaxPersons = 4;  // Jetson Nanoの性能を考慮した既定値（APP_MAX_PERSONS）
+  static constexpr int kMaxPersonsLimit = 1024;  // PersonTableと重複抑止の表をこの人数分確保する
+  using AlertsPtr = std::shared_ptr<const std::vector<Alert>>;
+  friend struct DetectionStoreTestAccess;  // テストからadd_alertを呼ぶ（tests/alert_log_test.cpp）
   
  private:
   bool auto_register_enabled_ = true;  // 自動登録モード
   
  public:
   void set_auto_register(bool enabled) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    WriteLock lock(*this);
     auto_register_enabled_ = enabled;
-    std::cout << "[config] Auto-register mode: " << (enabled ? "enabled" : "disabled") << std::endl;
+    notify_changed();
+    log_ << "[config] Auto-register mode: " << (enabled ? "enabled" : "disabled") << std::endl;
   }
   
   bool get_auto_register() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return auto_register_enabled_;
+    return snapshot()->auto_register;
+  }
+
+  // アラート発生時に呼ばれる。リスナーはmutex_を放してから（listener_mutex_の下で）呼ぶので、
+  // 重い処理でも読み手・他の書き手を止めない。解除（nullptr）は実行中の呼び出しの終了を待つ
+  void set_alert_listener(std::function<void(const Alert &)> listener) {
+    std::lock_guard<std::mutex> lock(listener_mutex_);
+    alert_listener_ = std::move(listener);
+  }
+
+  // アラート一覧か設定が変わったときに呼ばれる（同上。新しいスナップショットの公開後）
+  void set_change_listener(std::function<void()> listener) {
+    std::lock_guard<std::mutex> lock(listener_mutex_);
+    change_listener_ = std::move(listener);
+  }
+
+  // スナップショットの版が進んだときに呼ばれる（同上。検出結果の変化を含む）
+  void set_version_listener(std::function<void()> listener) {
+    std::lock_guard<std::mutex> lock(listener_mutex_);
+    version_listener_ = std::move(listener);
+  }
+
+  FrameSize get_frame_size() const {
+    return snapshot()->frame_size;
   }
   
-  DetectionStore() {
-    // 配列を初期化（全員未登録状態）
-    for (auto &person : registered_persons_) {
-      person.fixed_id = -1;
-      person.current_nvtracker_id = 0;
-      person.bbox_width = 0.0f;
-      person.bbox_height = 0.0f;
-      person.bbox_left = 0.0f;
-      person.bbox_top = 0.0f;
-      person.stable_bbox_top = 0.0f;
-      person.stable_bbox_height = 0.0f;
-      person.sitting_bbox_height = 0.0f;
-      person.prev_bbox_top = 0.0f;
-      person.prev_bbox_height = 0.0f;
-      person.lying_bbox_top = 0.0f;
-      person.frame_count = 0;
-      person.active = false;
-      person.is_lying = false;
-      person.is_sitting = false;
-      person.was_standing = false;
-    }
+  explicit DetectionStore(int max_persons = kDefaultMaxPersons)
+      : persons_(std::max(1, std::min(kMaxPersonsLimit, max_persons))),
+        last_alert_(static_cast<size_t>(persons_.capacity()) * kAlertTypeCount, 0) {
+    WriteLock lock(*this);
+    dirty_ = true;
   }
+
+  int max_persons() const { return persons_.capacity(); }
   
 
   
-  std::vector<Alert> get_alerts() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return alerts_;
+  AlertsPtr get_alerts() const {
+    return snapshot()->alerts;
   }
   
-  void acknowledge_alert(size_t index) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (index < alerts_.size()) {
-      alerts_[index].acknowledged = true;
+  // IDで確認済みにする。保持していないIDならfalse
+  bool acknowledge_alert(uint64_t id) {
+    WriteLock lock(*this);
+    Alert *alert = alerts_.find(id);
+    if (!alert) {
+      return false;
     }
+    if (!alert->acknowledged) {
+      alert->acknowledged = true;
+      alert->version = ++alerts_version_;
+      notify_alerts_changed();
+    }
+    return true;
   }
   
   void acknowledge_alerts_for_person(int fixed_id) {
     // 注意: この関数は既にmutex_がロックされている状態で呼ばれる
     // 内部用の関数なのでロックしない
-    for (auto &alert : alerts_) {
+    // 起き上がったときだけ呼ばれるので、リング全体（固定長）を見る
+    alerts_.for_each([&](Alert &alert) {
       if (alert.fixed_id == fixed_id && !alert.acknowledged) {
         alert.acknowledged = true;
-        std::cout << "[Alert] Auto-acknowledged alert for ID " << fixed_id << std::endl;
+        alert.version = ++alerts_version_;
+        notify_alerts_changed();
+        log_ << "[Alert] Auto-acknowledged alert for ID " << fixed_id << std::endl;
       }
-    }
+    });
   }
   
   void clear_alerts() {
-    std::lock_guard<std::mutex> lock(mutex_);
+    WriteLock lock(*this);
     alerts_.clear();
+    std::fill(last_alert_.begin(), last_alert_.end(), 0);
+    alerts_reset_version_ = ++alerts_version_;
+    notify_alerts_changed();
   }
   
 
   
-  void update(const std::vector<Detection> &detections) {
-    std::lock_guard<std::mutex> lock(mutex_);
+  void update(const std::vector<Detection> &detections, FrameSize frame_size) {
+    WriteLock lock(*this);
     detections_ = detections;
+    frame_size_ = frame_size;
+    dirty_ = true;
+    ++update_count_;
     auto now = std::chrono::steady_clock::now();
     
     // 自動登録: 未登録の検出を自動で追跡開始（モードが有効な場合のみ）
     if (auto_register_enabled_) {
       for (const auto &det : detections) {
-        bool already_tracked = false;
-        for (const auto &person : registered_persons_) {
-          if (person.active && person.current_nvtracker_id == det.tracking_id) {
-            already_tracked = true;
-            break;
-          }
+        if (persons_.find(det.tracking_id) >= 0) {
+          continue;
         }
-        
-        if (!already_tracked) {
-          // 空きスロットを探して自動登録（最大4人まで）
-          for (auto &person : registered_persons_) {
-            if (!person.active) {
-              person.fixed_id = &person - &registered_persons_[0];
-              person.current_nvtracker_id = det.tracking_id;
-            person.bbox_width = det.width;
-            person.bbox_height = det.height;
-            person.bbox_left = det.left;
-            person.bbox_top = det.top;
-            person.stable_bbox_top = det.top;  // 初期頭位置を記録
-            person.stable_bbox_height = det.height;  // 初期高さを記録
-            person.sitting_bbox_height = 0.0f;
-            person.prev_bbox_top = det.top;
-            person.prev_bbox_height = det.height;
-            person.lying_bbox_top = 0.0f;
-            person.last_seen = now;
-            person.last_update = now;
-            person.lying_start = now;
-            person.lying_stable = now;
-            person.standing_confirmed = now;
-            person.sitting_confirmed = now;
-            person.head_position_recorded = now;
-            person.frame_count = 0;
-            person.active = true;
-            person.is_lying = (det.width > det.height * 1.8f);  // 1.8倍で横たわり判定
-            person.is_sitting = false;
-            person.was_standing = !person.is_lying;
-            
-            std::cout << "[Auto] Registered nvtracker=" << det.tracking_id 
-                     << " as Fixed ID " << person.fixed_id << std::endl;
-            break;
-          }
+        // 空きスロットに自動登録（max_persons()人まで）
+        const int slot = start_tracking(det, now);
+        if (slot < 0) {
+          break;  // 満員
         }
+        log_ << "[Auto] Registered nvtracker=" << det.tracking_id
+             << " as Fixed ID " << slot << std::endl;
       }
     }
     
-    // 登録済み人物の追跡と異常検知
-    for (auto &person : registered_persons_) {
-      if (!person.active) continue;
+    // 登録済み人物の追跡と異常検知（検出ごとに索引でスロットを引く）
+    for (const auto &det : detections) {
+      const int slot = persons_.find(det.tracking_id);
+      if (slot < 0 || persons_.seen_update[slot] == update_count_) {
+        continue;  // 未登録か、同じIDの2つ目以降の検出
+      }
+      persons_.seen_update[slot] = update_count_;
+      track_person(slot, det, now);
+    }
       
-      bool found = false;
-      for (const auto &det : detections) {
-        if (det.tracking_id == person.current_nvtracker_id) {
-          found = true;
-          
-          // フレームカウント
-          person.frame_count++;
-          
-          // 転倒検知: 前フレームとの比較（10フレーム以上追跡後）
-          if (person.frame_count >= 10 && person.was_standing && person.prev_bbox_height > 100.0f) {
-            auto time_diff = std::chrono::duration_cast<std::chrono::milliseconds>(
-                now - person.last_update).count();
-            
-            // 急激な変化を検知（2秒以内）
-            if (time_diff > 0 && time_diff <= 2000) {
-              // 高さが50%以上減少（立っている→しゃがむ/倒れる）
-              float height_ratio = det.height / person.prev_bbox_height;
-              // 頭の位置が大きく下がった（画面下方向 = Y座標増加）
-              float top_diff = det.top - person.prev_bbox_top;
-              
-              // デバッグ: 急激な変化を検出
-              if (height_ratio < 0.7f && top_diff > 50.0f) {
-                std::cout << "[Fall Check] ID " << person.fixed_id 
-                         << " height_ratio:" << std::fixed << std::setprecision(2) << height_ratio
-                         << " top_diff:" << (int)top_diff 
-                         << " prev_h:" << (int)person.prev_bbox_height << std::endl;
-              }
-              
-              // 転倒条件: 高さが30%以上減少 OR 頭が大きく下がった
-              if ((height_ratio < 0.7f && top_diff > person.prev_bbox_height * 0.3f) ||
-                  (height_ratio < 0.5f && top_diff > person.prev_bbox_height * 0.15f)) {
-                // 転倒検知！（add_alert内で重複チェックあり）
-                add_alert(person.fixed_id, ALERT_FALL, 
-                         "Sudden fall detected", now);
-                // ログは1回だけ出す（重複防止）
-                bool already_alerted = false;
-                for (const auto &alert : alerts_) {
-                  if (alert.fixed_id == person.fixed_id && alert.type == ALERT_FALL && !alert.acknowledged) {
-                    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-                        now - alert.timestamp).count();
-                    if (elapsed < 5) {
-                      already_alerted = true;
-                      break;
-                    }
-                  }
-                }
-                if (!already_alerted) {
-                  std::cout << "[Alert] Fixed ID " << person.fixed_id 
-                           << " FALL detected! height:" << (int)person.prev_bbox_height 
-                           << "->" << (int)det.height 
-                           << " top:" << (int)person.prev_bbox_top << "->" << (int)det.top << std::endl;
-                }
-              }
-            }
-          }
-          
-          // 位置・姿勢情報を更新
-          person.prev_bbox_top = person.bbox_top;
-          person.prev_bbox_height = person.bbox_height;
-          person.bbox_width = det.width;
-          person.bbox_height = det.height;
-          person.bbox_left = det.left;
-          person.bbox_top = det.top;
-          person.last_seen = now;
-          person.last_update = now;
-          
-          // 姿勢判定
-          // 横たわり = 幅が高さより大きい（横向きbbox）
-          bool is_lying = (det.width > det.height * 1.2f);  // 1.2倍で横たわり判定（より敏感に）
-          bool is_sitting = false;
-          
-          // デバッグ: 姿勢判定（15フレームごと = 約1秒）
-          if (person.frame_count % 15 == 0) {
-            float ratio = det.width / det.height;
-            std::cout << "[Debug] ID " << person.fixed_id 
-                     << " bbox:" << (int)det.width << "x" << (int)det.height 
-                     << " ratio:" << std::fixed << std::setprecision(2) << ratio 
-                     << " lying:" << (is_lying ? "YES" : "NO") << std::endl;
-          }
-          
-          // 座っている判定: 立っている時の60-80%の高さ
-          if (!is_lying && person.stable_bbox_height > 100.0f) {
-            float height_ratio = det.height / person.stable_bbox_height;
-            is_sitting = (height_ratio >= 0.55f && height_ratio <= 0.85f);
-          }
-          
-          // 立っている状態が3秒以上続いたら確定
-          if (!is_lying && !is_sitting) {
-            auto standing_sec = std::chrono::duration_cast<std::chrono::seconds>(
-                now - person.standing_confirmed).count();
-            if (standing_sec >= 3) {
-              person.was_standing = true;
-              // 安定時の高さと頭位置を更新（立っている時の平均）
-              person.stable_bbox_height = (person.stable_bbox_height * 0.8f + det.height * 0.2f);
-              person.stable_bbox_top = (person.stable_bbox_top * 0.8f + det.top * 0.2f);
-              person.head_position_recorded = now;
-            }
-          } else {
-            // 横たわったら立っている確定時刻をリセット
-            person.standing_confirmed = now;
-          }
-          
-          // 座っている状態が2秒以上続いたら確定
-          if (is_sitting) {
-            auto sitting_sec = std::chrono::duration_cast<std::chrono::seconds>(
-                now - person.sitting_confirmed).count();
-            if (sitting_sec >= 2) {
-              person.is_sitting = true;
-              // 座っている時の高さを記録
-              person.sitting_bbox_height = (person.sitting_bbox_height * 0.7f + det.height * 0.3f);
-            }
-          } else {
-            person.sitting_confirmed = now;
-            if (!is_lying) {
-              person.is_sitting = false;
-            }
-          }
-          
-          // 異常検知
-          check_alerts(person, det, is_lying, now);
-          
-          person.is_lying = is_lying;
-          
-          break;
-        }
+    // 見つからない場合（bbox消失）
+    const std::vector<int> &active = persons_.active();
+    for (size_t i = 0; i < active.size();) {
+      const int slot = active[i];
+      if (persons_.seen_update[slot] == update_count_) {
+        ++i;
+        continue;
       }
+      auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+          now - persons_.last_seen[slot]).count();
       
-      // 見つからない場合（bbox消失）
-      if (!found) {
-        auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-            now - person.last_seen).count();
-        
-        // 10秒以上見失ったら徘徊の可能性としてアラート
-        if (elapsed >= 10 && elapsed < 11) {
-          add_alert(person.fixed_id, ALERT_FRAME_OUT, 
-                   "Left the frame - possible wandering", now);
-          std::cout << "[Alert] Fixed ID " << person.fixed_id 
-                   << " left the frame (>10s) - possible wandering" << std::endl;
-        }
-        
-        // 60秒以上見失ったら追跡解除
-        if (elapsed >= 60) {
-          std::cout << "[Track] Fixed ID " << person.fixed_id 
-                   << " tracking stopped (>60s)" << std::endl;
-          person.active = false;
-        }
+      // 10秒以上見失ったら徘徊の可能性としてアラート
+      if (elapsed >= 10 && elapsed < 11) {
+        add_alert(slot, ALERT_FRAME_OUT, 
+                 "Left the frame - possible wandering", now);
+        log_ << "[Alert] Fixed ID " << slot 
+             << " left the frame (>10s) - possible wandering" << std::endl;
       }
+      
+      // 60秒以上見失ったら追跡解除
+      if (elapsed >= 60) {
+        log_ << "[Track] Fixed ID " << slot 
+             << " tracking stopped (>60s)" << std::endl;
+        persons_.release(slot);  // activeの末尾がiへ移る
+        continue;
+      }
+      ++i;
     }
-  }  // end of tracking loop
-}  // end of update()
+  }  // end of update()
   
  private:
-  void check_alerts(RegisteredPerson &person, const Detection &det, bool is_lying,
-                   std::chrono::steady_clock::time_point now) {
+  // 空きスロットに登録して追跡を始める（自動・手動共通）。満員なら-1
+  int start_tracking(const Detection &det, std::chrono::steady_clock::time_point now) {
+    const int slot = persons_.acquire(det.tracking_id);
+    if (slot < 0) {
+      return -1;
+    }
+    persons_.bbox_width[slot] = det.width;
+    persons_.bbox_height[slot] = det.height;
+    persons_.bbox_left[slot] = det.left;
+    persons_.bbox_top[slot] = det.top;
+    persons_.prev_bbox_top[slot] = det.top;
+    persons_.prev_bbox_height[slot] = det.height;
+    persons_.frame_count[slot] = 0;
+    persons_.seen_update[slot] = 0;
+    persons_.last_seen[slot] = now;
+    persons_.last_update[slot] = now;
+    PersonState &person = persons_.state[slot];
+    person.stable_bbox_top = det.top;  // 初期頭位置を記録
+    person.stable_bbox_height = det.height;  // 初期高さを記録
+    person.sitting_bbox_height = 0.0f;
+    person.lying_bbox_top = 0.0f;
+    person.lying_start = now;
+    person.lying_stable = now;
+    person.standing_confirmed = now;
+    person.sitting_confirmed = now;
+    person.head_position_recorded = now;
+    person.is_lying = (det.width > det.height * 1.8f);  // 1.8倍で横たわり判定
+    person.is_sitting = false;
+    person.was_standing = !person.is_lying;
+    return slot;
+  }
+
+  void track_person(int slot, const Detection &det, std::chrono::steady_clock::time_point now) {
+    PersonState &person = persons_.state[slot];
+    float &prev_bbox_top = persons_.prev_bbox_top[slot];
+    float &prev_bbox_height = persons_.prev_bbox_height[slot];
+
+    // フレームカウント
+    const int frame_count = ++persons_.frame_count[slot];
+    
+    // 転倒検知: 前フレームとの比較（10フレーム以上追跡後）
+    if (frame_count >= 10 && person.was_standing && prev_bbox_height > 100.0f) {
+      auto time_diff = std::chrono::duration_cast<std::chrono::milliseconds>(
+          now - persons_.last_update[slot]).count();
+      
+      // 急激な変化を検知（2秒以内）
+      if (time_diff > 0 && time_diff <= 2000) {
+        // 高さが50%以上減少（立っている→しゃがむ/倒れる）
+        float height_ratio = det.height / prev_bbox_height;
+        // 頭の位置が大きく下がった（画面下方向 = Y座標増加）
+        float top_diff = det.top - prev_bbox_top;
+        
+        // デバッグ: 急激な変化を検出
+        if (height_ratio < 0.7f && top_diff > 50.0f) {
+          log_ << "[Fall Check] ID " << slot 
+               << " height_ratio:" << std::fixed << std::setprecision(2) << height_ratio
+               << " top_diff:" << (int)top_diff 
+               << " prev_h:" << (int)prev_bbox_height << std::endl;
+        }
+        
+        // 転倒条件: 高さが30%以上減少 OR 頭が大きく下がった
+        if ((height_ratio < 0.7f && top_diff > prev_bbox_height * 0.3f) ||
+            (height_ratio < 0.5f && top_diff > prev_bbox_height * 0.15f)) {
+          // 転倒検知！（add_alert内で重複チェックあり）
+          // ログは新しくアラートを出したときだけ（重複防止）
+          if (add_alert(slot, ALERT_FALL, 
+                        "Sudden fall detected", now)) {
+            log_ << "[Alert] Fixed ID " << slot 
+                 << " FALL detected! height:" << (int)prev_bbox_height 
+                 << "->" << (int)det.height 
+                 << " top:" << (int)prev_bbox_top << "->" << (int)det.top << std::endl;
+          }
+        }
+      }
+    }
+    
+    // 位置・姿勢情報を更新
+    prev_bbox_top = persons_.bbox_top[slot];
+    prev_bbox_height = persons_.bbox_height[slot];
+    persons_.bbox_width[slot] = det.width;
+    persons_.bbox_height[slot] = det.height;
+    persons_.bbox_left[slot] = det.left;
+    persons_.bbox_top[slot] = det.top;
+    persons_.last_seen[slot] = now;
+    persons_.last_update[slot] = now;
+    
+    // 姿勢判定
+    // 横たわり = 幅が高さより大きい（横向きbbox）
+    bool is_lying = (det.width > det.height * 1.2f);  // 1.2倍で横たわり判定（より敏感に）
+    bool is_sitting = false;
+    
+    // デバッグ: 姿勢判定（15フレームごと = 約1秒）
+    if (frame_count % 15 == 0) {
+      float ratio = det.width / det.height;
+      log_ << "[Debug] ID " << slot 
+           << " bbox:" << (int)det.width << "x" << (int)det.height 
+           << " ratio:" << std::fixed << std::setprecision(2) << ratio 
+           << " lying:" << (is_lying ? "YES" : "NO") << std::endl;
+    }
+    
+    // 座っている判定: 立っている時の60-80%の高さ
+    if (!is_lying && person.stable_bbox_height > 100.0f) {
+      float height_ratio = det.height / person.stable_bbox_height;
+      is_sitting = (height_ratio >= 0.55f && height_ratio <= 0.85f);
+    }
+    
+    // 立っている状態が3秒以上続いたら確定
+    if (!is_lying && !is_sitting) {
+      auto standing_sec = std::chrono::duration_cast<std::chrono::seconds>(
+          now - person.standing_confirmed).count();
+      if (standing_sec >= 3) {
+        person.was_standing = true;
+        // 安定時の高さと頭位置を更新（立っている時の平均）
+        person.stable_bbox_height = (person.stable_bbox_height * 0.8f + det.height * 0.2f);
+        person.stable_bbox_top = (person.stable_bbox_top * 0.8f + det.top * 0.2f);
+        person.head_position_recorded = now;
+      }
+    } else {
+      // 横たわったら立っている確定時刻をリセット
+      person.standing_confirmed = now;
+    }
+    
+    // 座っている状態が2秒以上続いたら確定
+    if (is_sitting) {
+      auto sitting_sec = std::chrono::duration_cast<std::chrono::seconds>(
+          now - person.sitting_confirmed).count();
+      if (sitting_sec >= 2) {
+        person.is_sitting = true;
+        // 座っている時の高さを記録
+        person.sitting_bbox_height = (person.sitting_bbox_height * 0.7f + det.height * 0.3f);
+      }
+    } else {
+      person.sitting_confirmed = now;
+      if (!is_lying) {
+        person.is_sitting = false;
+      }
+    }
+    
+    // 異常検知
+    check_alerts(slot, det, is_lying, now);
+    
+    person.is_lying = is_lying;
+  }
+
+  void check_alerts(int slot, const Detection &det, bool is_lying,
+                   std::chrono::steady_clock::time_point now) {
     
     // 最低10フレーム（約2秒）追跡してから異常検知開始
-    if (person.frame_count < 10) {
+    if (persons_.frame_count[slot] < 10) {
       return;
     }
+    PersonState &person = persons_.state[slot];
     
     // 横たわり状態の記録とベッド落下検知
     if (is_lying) {
@@ -467,7 +1118,7 @@ class DetectionStore {
         person.lying_start = now;
         person.lying_stable = now;
         person.lying_bbox_top = det.top;
-        std::cout << "[State] ID " << person.fixed_id 
+        log_ << "[State] ID " << slot 
                  << " 縦長→横長 (lying down at Y:" << (int)det.top << ")" << std::endl;
       } else {
         // 横たわり状態が3秒以上続いたら安定とみなす
@@ -484,9 +1135,9 @@ class DetectionStore {
           // ベッド落下検知: 横たわり状態から急激にY座標が増加（下に落ちた）
           float top_diff = det.top - person.lying_bbox_top;
           if (top_diff > 150.0f) {  // 150px以上下がったら落下
-            add_alert(person.fixed_id, ALERT_BED_FALL, 
+            add_alert(slot, ALERT_BED_FALL, 
                      "Bed fall detected", now);
-            std::cout << "[Alert] Fixed ID " << person.fixed_id 
+            log_ << "[Alert] Fixed ID " << slot 
                      << " BED FALL detected! Y:" << (int)person.lying_bbox_top 
                      << "->" << (int)det.top << " (diff:" << (int)top_diff << ")" << std::endl;
             // 落下後は新しい位置を基準に
@@ -499,11 +1150,11 @@ class DetectionStore {
       if (person.lying_start.time_since_epoch().count() != 0) {
         auto lying_sec = std::chrono::duration_cast<std::chrono::seconds>(
             now - person.lying_start).count();
-        std::cout << "[State] ID " << person.fixed_id 
+        log_ << "[State] ID " << slot 
                  << " 横長→縦長 (standing up, was lying for " 
                  << lying_sec << "s)" << std::endl;
         // 起き上がったら、転倒・落下アラートを自動確認
-        acknowledge_alerts_for_person(person.fixed_id);
+        acknowledge_alerts_for_person(slot);
       }
       person.lying_start = std::chrono::steady_clock::time_point();
       person.lying_stable = std::chrono::steady_clock::time_point();
@@ -511,16 +1162,16 @@ class DetectionStore {
     }
   }
   
-  void add_alert(int fixed_id, AlertType type, const std::string &message,
+  // 追加したらtrue、重複で見送ったらfalse
+  bool add_alert(int fixed_id, AlertType type, const std::string &message,
                 std::chrono::steady_clock::time_point timestamp) {
-    // 重複アラート防止（同じ人の同じタイプのアラートが最近あれば追加しない）
-    for (const auto &alert : alerts_) {
-      if (alert.fixed_id == fixed_id && alert.type == type && !alert.acknowledged) {
-        auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-            timestamp - alert.timestamp).count();
-        if (elapsed < 30) {  // 30秒以内は重複とみなす
-          return;  // 重複
-        }
+    // 重複アラート防止（同じ人の同じタイプの未確認アラートが最近あれば追加しない）
+    uint64_t &last_id = last_alert_[static_cast<size_t>(fixed_id) * kAlertTypeCount + type];
+    if (const Alert *last = alerts_.find(last_id)) {
+      auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+          timestamp - last->timestamp).count();
+      if (!last->acknowledged && elapsed < 30) {  // 30秒以内は重複とみなす
+        return false;  // 重複
       }
     }
     
@@ -530,9 +1181,14 @@ class DetectionStore {
     alert.message = message;
     alert.timestamp = timestamp;
     alert.acknowledged = false;
-    alerts_.push_back(alert);
+    alert.version = ++alerts_version_;
+    const Alert &added = alerts_.push(std::move(alert));
+    last_id = added.id;
+    pending_alerts_.push_back(added);  // WriteLock解放後にalert_listener_へ渡す
+    notify_alerts_changed();
     
-    std::cout << "[Alert] Fixed ID " << fixed_id << ": " << message << std::endl;
+    log_ << "[Alert] Fixed ID " << fixed_id << ": " << message << std::endl;
+    return true;
   }
   
  public:
@@ -540,85 +1196,82 @@ class DetectionStore {
   struct DetectionWithFixedId {
     Detection detection;
     int fixed_id;  // -1 = 未登録
+
+    bool operator==(const DetectionWithFixedId &other) const {
+      const Detection &a = detection;
+      const Detection &b = other.detection;
+      return fixed_id == other.fixed_id && a.tracking_id == b.tracking_id &&
+             a.class_id == b.class_id && a.confidence == b.confidence &&
+             a.left == b.left && a.top == b.top && a.width == b.width &&
+             a.height == b.height;
+    }
   };
+
+  // 読み出し用の不変スナップショット。変更のたびに新しいものを作って差し替えるので、
+  // 読み手はmutex_を取らず（update()の追跡処理を待たずに）読める
+  struct Snapshot {
+    uint64_t version = 0;  // 内容が変わるたびに増える。JSONキャッシュ・?since= の判定に使う
+    FrameSize frame_size;
+    std::vector<DetectionWithFixedId> detections;
+    AlertsPtr alerts;  // アラートが変わらない間は前の版と共有する
+    uint64_t alerts_version = 0;  // アラートの追加・確認・クリアのたびに増える
+    uint64_t alerts_reset_version = 0;  // 最後にクリアしたときのalerts_version
+    bool auto_register = true;
+  };
+  using SnapshotPtr = std::shared_ptr<const Snapshot>;
+
+  SnapshotPtr snapshot() const {
+    return std::atomic_load(&snapshot_);
+  }
   
   std::vector<DetectionWithFixedId> get_with_fixed_ids() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    std::vector<DetectionWithFixedId> result;
+    return snapshot()->detections;
+  }
+
+ private:
+  // mutex_を保持して呼ぶ
+  void fill_with_fixed_ids(std::vector<DetectionWithFixedId> &result) const {
+    result.clear();
     
     for (const auto &det : detections_) {
       DetectionWithFixedId dwf;
       dwf.detection = det;
-      dwf.fixed_id = -1;  // デフォルトは未登録
-      
-      // 登録済み人物のnvtracker IDと一致するか確認
-      for (const auto &person : registered_persons_) {
-        if (person.active && person.current_nvtracker_id == det.tracking_id) {
-          dwf.fixed_id = person.fixed_id;
-          break;
-        }
-      }
+      dwf.fixed_id = persons_.find(det.tracking_id);  // -1 = 未登録
       
       result.push_back(dwf);
     }
-    
-    return result;
   }
 
+ public:
   std::vector<Detection> get() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return detections_;
+    std::vector<Detection> result;
+    for (const auto &entry : snapshot()->detections) {
+      result.push_back(entry.detection);
+    }
+    return result;
   }
 
   // 手動登録（手動モード用）
   bool register_by_nvtracker_id(uint64_t nvtracker_id) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    WriteLock lock(*this);
     
     // 既に登録されているか確認
-    for (const auto &person : registered_persons_) {
-      if (person.active && person.current_nvtracker_id == nvtracker_id) {
-        std::cout << "[api] Already registered: nvtracker=" << nvtracker_id << std::endl;
-        return false;
-      }
+    if (persons_.find(nvtracker_id) >= 0) {
+      log_ << "[api] Already registered: nvtracker=" << nvtracker_id << std::endl;
+      return false;
     }
     
-    // 空きスロットを探す
-    for (auto &person : registered_persons_) {
-      if (!person.active) {
-        // 検出情報から登録
-        for (const auto &det : detections_) {
-          if (det.tracking_id == nvtracker_id) {
-            auto now = std::chrono::steady_clock::now();
-            person.fixed_id = &person - &registered_persons_[0];
-            person.current_nvtracker_id = nvtracker_id;
-            person.bbox_width = det.width;
-            person.bbox_height = det.height;
-            person.bbox_left = det.left;
-            person.bbox_top = det.top;
-            person.stable_bbox_top = det.top;
-            person.stable_bbox_height = det.height;
-            person.sitting_bbox_height = 0.0f;
-            person.prev_bbox_top = det.top;
-            person.prev_bbox_height = det.height;
-            person.lying_bbox_top = 0.0f;
-            person.last_seen = now;
-            person.last_update = now;
-            person.lying_start = now;
-            person.lying_stable = now;
-            person.standing_confirmed = now;
-            person.sitting_confirmed = now;
-            person.head_position_recorded = now;
-            person.frame_count = 0;
-            person.active = true;
-            person.is_lying = (det.width > det.height * 1.8f);
-            person.is_sitting = false;
-            person.was_standing = !person.is_lying;
-            
-            std::cout << "[api] Manually registered nvtracker=" << nvtracker_id 
-                     << " as Fixed ID " << person.fixed_id << std::endl;
-            return true;
-          }
+    // 検出情報から空きスロットに登録
+    for (const auto &det : detections_) {
+      if (det.tracking_id == nvtracker_id) {
+        const int slot = start_tracking(det, std::chrono::steady_clock::now());
+        if (slot < 0) {
+          return false;
         }
+        dirty_ = true;
+        log_ << "[api] Manually registered nvtracker=" << nvtracker_id 
+             << " as Fixed ID " << slot << std::endl;
+        return true;
       }
     }
     
@@ -627,380 +1280,3347 @@ class DetectionStore {
   
   // 固定IDを指定して登録解除（タップで解除）
   bool unregister_by_nvtracker_id(uint64_t nvtracker_id) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    WriteLock lock(*this);
     
-    for (auto &person : registered_persons_) {
-      if (person.active && person.current_nvtracker_id == nvtracker_id) {
-        std::cout << "[api] Unregistered nvtracker=" << nvtracker_id 
-                 << " (Fixed ID " << person.fixed_id << ")" << std::endl;
-        person.active = false;
-        return true;
+    const int slot = persons_.find(nvtracker_id);
+    if (slot < 0) {
+      return false;
+    }
+    log_ << "[api] Unregistered nvtracker=" << nvtracker_id 
+         << " (Fixed ID " << slot << ")" << std::endl;
+    persons_.release(slot);
+    dirty_ = true;
+    return true;
+  }
+
+  // 固定IDを指定して登録解除
+  bool unregister_person(int fixed_id) {
+    WriteLock lock(*this);
+    
+    if (!persons_.is_active(fixed_id)) {
+      return false;
+    }
+    
+    persons_.release(fixed_id);
+    dirty_ = true;
+    log_ << "[api] Unregistered Fixed ID " << fixed_id << std::endl;
+    return true;
+  }
+
+  // 全員登録解除
+  void clear_all() {
+    WriteLock lock(*this);
+    persons_.clear();
+    dirty_ = true;
+    log_ << "[api] Cleared all registrations" << std::endl;
+  }
+
+ private:
+  // 変更用のロック。解放時に、変更があれば新しいスナップショットを公開する。
+  // 追跡処理中のログとリスナーへの通知は溜めておき、mutex_を放してから出す
+  class WriteLock {
+   public:
+    explicit WriteLock(DetectionStore &store) : store_(store), lock_(store.mutex_) {}
+
+    ~WriteLock() {
+      const bool published = store_.dirty_ && store_.publish_snapshot();
+      const bool changed = store_.state_changed_;
+      store_.state_changed_ = false;
+      std::vector<Alert> alerts;
+      alerts.swap(store_.pending_alerts_);
+      std::string log;
+      if (store_.log_.tellp() > 0) {
+        log = store_.log_.str();
+        store_.log_.str("");
+      }
+      lock_.unlock();
+      if (!log.empty()) {
+        std::cout << log << std::flush;
+      }
+      if (published || changed || !alerts.empty()) {
+        std::lock_guard<std::mutex> listeners(store_.listener_mutex_);
+        if (store_.alert_listener_) {
+          for (const Alert &alert : alerts) {
+            store_.alert_listener_(alert);
+          }
+        }
+        if (published && store_.version_listener_) {
+          store_.version_listener_();
+        }
+        if (changed && store_.change_listener_) {
+          store_.change_listener_();
+        }
+      }
+    }
+
+   private:
+    DetectionStore &store_;
+    std::unique_lock<std::mutex> lock_;
+  };
+
+  // 以下はmutex_を保持して呼ぶ
+  void notify_changed() {
+    dirty_ = true;
+    state_changed_ = true;
+  }
+
+  void notify_alerts_changed() {
+    alerts_dirty_ = true;
+    notify_changed();
+  }
+
+  // 前の版と内容が同じなら版を進めずにfalse（無人の部屋で毎フレーム版が変わらないように）
+  bool publish_snapshot() {
+    dirty_ = false;
+    auto next = std::make_shared<Snapshot>();
+    next->frame_size = frame_size_;
+    fill_with_fixed_ids(next->detections);
+    if (alerts_dirty_ || !alerts_snapshot_) {
+      alerts_snapshot_ = std::make_shared<const std::vector<Alert>>(alerts_.to_vector());
+      alerts_dirty_ = false;
+    }
+    next->alerts = alerts_snapshot_;
+    next->alerts_version = alerts_version_;
+    next->alerts_reset_version = alerts_reset_version_;
+    next->auto_register = auto_register_enabled_;
+    if (snapshot_ && snapshot_->frame_size.width == next->frame_size.width &&
+        snapshot_->frame_size.height == next->frame_size.height &&
+        snapshot_->alerts == next->alerts &&
+        snapshot_->auto_register == next->auto_register &&
+        snapshot_->detections == next->detections) {
+      return false;
+    }
+    next->version = ++version_;
+    std::atomic_store(&snapshot_, SnapshotPtr(std::move(next)));
+    return true;
+  }
+
+  mutable std::mutex mutex_;
+  std::vector<Detection> detections_;
+  PersonTable persons_;
+  uint64_t update_count_ = 0;
+  AlertLog alerts_;
+  std::vector<uint64_t> last_alert_;  // (固定ID, 種類) → 最後に出したアラートのID（0 = なし）
+  uint64_t alerts_version_ = 0;
+  uint64_t alerts_reset_version_ = 0;
+  std::vector<Alert> pending_alerts_;  // 次のWriteLock解放時にalert_listener_へ渡す
+  std::mutex listener_mutex_;  // 以下3つのリスナーの設定と呼び出し（mutex_の外）
+  std::function<void(const Alert &)> alert_listener_;
+  std::function<void()> change_listener_;
+  std::function<void()> version_listener_;
+  FrameSize frame_size_;
+  uint64_t version_ = 0;
+  bool dirty_ = false;  // 次のWriteLock解放時にスナップショットを公開する
+  bool state_changed_ = false;  // 同じく、change_listener_を呼ぶ
+  bool alerts_dirty_ = false;
+  AlertsPtr alerts_snapshot_;
+  SnapshotPtr snapshot_;
+  std::ostringstream log_;  // WriteLock解放後に出力するログ
+};
+
+void write_detection_json(JsonWriter &json, const DetectionStore::DetectionWithFixedId &entry) {
+  const auto &d = entry.detection;
+  json.begin_object()
+      .key("nvtracker_id").value(d.tracking_id)
+      .key("fixed_id").value(entry.fixed_id)
+      .key("registered").value(entry.fixed_id >= 0)
+      .key("class_id").value(d.class_id)
+      .key("confidence").value(d.confidence)
+      .key("bbox").begin_object()
+      .key("left").value(d.left)
+      .key("top").value(d.top)
+      .key("width").value(d.width)
+      .key("height").value(d.height)
+      .end_object()
+      .end_object();
+}
+
+// {"width":..,"height":..,"detections":[...]} の中身（/stream?meta=1 ではsequenceが前に付く）
+void write_detections_fields(JsonWriter &json, FrameSize frame_size,
+                             const std::vector<DetectionStore::DetectionWithFixedId> &detections) {
+  json.key("width").value(frame_size.width)
+      .key("height").value(frame_size.height)
+      .key("detections").begin_array();
+  for (const auto &entry : detections) {
+    write_detection_json(json, entry);
+  }
+  json.end_array();
+}
+
+// /api/detections（版付き。?since= に渡す）
+void write_detections_json(JsonWriter &json, const DetectionStore::Snapshot &snapshot) {
+  json.clear();
+  json.begin_object().key("version").value(snapshot.version);
+  write_detections_fields(json, snapshot.frame_size, snapshot.detections);
+  json.end_object();
+}
+
+// /stream?meta=1 のJSONパート（フレーム番号付き）
+void write_frame_meta_json(JsonWriter &json, uint64_t sequence,
+                           const std::vector<DetectionStore::DetectionWithFixedId> &detections,
+                           FrameSize frame_size) {
+  json.clear();
+  json.begin_object().key("sequence").value(sequence);
+  write_detections_fields(json, frame_size, detections);
+  json.end_object();
+}
+
+// アラート一覧のJSON。sinceを指定すると、その版より後に追加・確認されたものだけを返す。
+// sinceより後にクリアされていたら（または再起動で版が戻っていたら）全件を返してreset:true。
+// first_idより古いIDはリングからあふれたので、クライアント側でも捨ててよい
+std::string alerts_to_json(const DetectionStore::Snapshot &snapshot, uint64_t since = 0) {
+  const std::vector<Alert> &alerts = *snapshot.alerts;
+  const bool reset = since == 0 || since < snapshot.alerts_reset_version ||
+                     since > snapshot.alerts_version;
+  thread_local JsonWriter json;  // 呼ぶスレッド（HTTPワーカー・EventStream）ごとにバッファを使い回す
+  json.clear();
+  json.begin_object()
+      .key("version").value(snapshot.alerts_version)
+      .key("first_id").value(alerts.empty() ? uint64_t{0} : alerts.front().id)
+      .key("reset").value(reset)
+      .key("alerts").begin_array();
+  for (size_t i = 0; i < alerts.size(); ++i) {
+    const auto &a = alerts[i];
+    if (!reset && a.version <= since) {
+      continue;
+    }
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        a.timestamp.time_since_epoch()).count();
+    json.begin_object()
+        .key("index").value(static_cast<uint64_t>(i))
+        .key("id").value(a.id)
+        .key("fixed_id").value(a.fixed_id)
+        .key("type").value(static_cast<int>(a.type))
+        .key("message").value(a.message)
+        .key("timestamp").value(static_cast<int64_t>(ms))
+        .key("acknowledged").value(a.acknowledged)
+        .end_object();
+  }
+  json.end_array().end_object();
+  return json.str();
+}
+
+// /api/detections のJSON。検出結果の版ごとに1回だけ直列化し、
+// 同じ版を読むリクエスト・/api/events で共有する
+class DetectionJsonCache {
+ public:
+  explicit DetectionJsonCache(const DetectionStore &store) : store_(store) {}
+
+  std::shared_ptr<const std::string> get() {
+    uint64_t version;
+    return get(version);
+  }
+
+  // versionには本文の版（DetectionStore::Snapshot::version）が入る
+  std::shared_ptr<const std::string> get(uint64_t &version) {
+    const DetectionStore::SnapshotPtr snapshot = store_.snapshot();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!cached_ || snapshot->version != cached_version_) {
+      write_detections_json(json_, *snapshot);
+      cached_ = std::make_shared<const std::string>(json_.str());
+      cached_version_ = snapshot->version;
+    }
+    version = cached_version_;
+    return cached_;
+  }
+
+ private:
+  const DetectionStore &store_;
+  std::mutex mutex_;
+  std::shared_ptr<const std::string> cached_;
+  uint64_t cached_version_ = 0;
+  JsonWriter json_;
+};
+
+// 検出結果のバイナリ表現（帯域の細い無線LAN向け）。すべてリトルエンディアン。
+// ヘッダ20バイト:
+//   "ERMD" | u8 形式版(2) | u8 flags(bit0=差分) | u16 件数 | u16 width | u16 height |
+//   u32 版 | u32 差分の基準版（キーフレームは0）
+// レコードは先頭のtagで2種類:
+//   絶対値 21バイト: u8 tag=0 | i16 fixed_id | u8 class_id | u8 confidence(x255) |
+//                    u64 nvtracker_id | i16 left, top, width, height
+//   差分    9バイト: u8 tag=1 | i16 fixed_id | u8 基準フレームでの位置 | u8 confidence |
+//                    i8 left, top, width, height の基準フレームからの差
+// 差分レコードのnvtracker_id・class_idは基準フレームの同じ位置のレコードと同じ。
+// 基準フレームに同じnvtracker_idがないか、差がi8に収まらなければ絶対値で送る。
+class DetectionBinaryCache {
+ public:
+  static constexpr const char *kContentType = "application/x-edge-detections";
+  static constexpr size_t kHeaderBytes = 20;
+  static constexpr size_t kAbsoluteBytes = 21;
+  static constexpr size_t kDeltaBytes = 9;
+
+  struct Encoded {
+    std::shared_ptr<const std::string> data;
+    uint32_t version = 0;
+    uint32_t base = 0;  // 0ならキーフレーム
+  };
+
+  explicit DetectionBinaryCache(const DetectionStore &store) : store_(store) {}
+
+  // baseは受信側が最後に復元した版。最近送った版ならその差分、なければキーフレーム
+  Encoded get(uint32_t base) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Frame &frame = current();
+    Encoded encoded;
+    encoded.version = frame.version;
+    const Frame *base_frame = base != 0 ? find(base) : nullptr;
+    if (!base_frame) {
+      encoded.data = frame.keyframe;
+      return encoded;
+    }
+    auto data = std::make_shared<std::string>();
+    encode(frame, base_frame, *data);
+    encoded.data = std::move(data);
+    encoded.base = base;
+    return encoded;
+  }
+
+ private:
+  // 差分の基準にできる版の数（送った版だけを覚える）
+  static constexpr size_t kHistory = 16;
+
+  struct Record {
+    uint64_t tracking_id = 0;
+    int16_t fixed_id = -1;
+    uint8_t class_id = 0;
+    uint8_t confidence = 0;
+    std::array<int16_t, 4> bbox {};  // left, top, width, height（ピクセル）
+  };
+
+  struct Frame {
+    uint32_t version = 0;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    std::vector<Record> records;
+    std::shared_ptr<const std::string> keyframe;
+  };
+
+  static int16_t to_i16(float value) {
+    const long rounded = std::lround(std::isfinite(value) ? value : 0.0f);
+    return static_cast<int16_t>(std::max(-32768L, std::min(32767L, rounded)));
+  }
+
+  static void put_u16(std::string &out, uint16_t value) {
+    out += static_cast<char>(value & 0xff);
+    out += static_cast<char>(value >> 8);
+  }
+
+  static void put_u32(std::string &out, uint32_t value) {
+    put_u16(out, static_cast<uint16_t>(value & 0xffff));
+    put_u16(out, static_cast<uint16_t>(value >> 16));
+  }
+
+  static void put_u64(std::string &out, uint64_t value) {
+    put_u32(out, static_cast<uint32_t>(value & 0xffffffffu));
+    put_u32(out, static_cast<uint32_t>(value >> 32));
+  }
+
+  // mutex_を保持して呼ぶ。ストアの版が進んでいれば量子化してキーフレームを作り直す
+  const Frame &current() {
+    const DetectionStore::SnapshotPtr snapshot = store_.snapshot();
+    Frame &newest = history_[newest_];
+    if (newest.keyframe && static_cast<uint32_t>(snapshot->version) == newest.version) {
+      return newest;
+    }
+    const FrameSize frame_size = snapshot->frame_size;
+    newest_ = (newest_ + 1) % kHistory;
+    Frame &frame = history_[newest_];
+    frame.version = static_cast<uint32_t>(snapshot->version);
+    frame.width = static_cast<uint16_t>(std::max(0, std::min(65535, frame_size.width)));
+    frame.height = static_cast<uint16_t>(std::max(0, std::min(65535, frame_size.height)));
+    frame.records.clear();
+    for (const auto &entry : snapshot->detections) {
+      if (frame.records.size() == 65535) {
+        break;
+      }
+      const auto &d = entry.detection;
+      Record record;
+      record.tracking_id = d.tracking_id;
+      record.fixed_id = static_cast<int16_t>(std::max(-1, std::min(32767, entry.fixed_id)));
+      record.class_id = static_cast<uint8_t>(std::max(0, std::min(255, d.class_id)));
+      record.confidence = static_cast<uint8_t>(
+          std::lround(std::max(0.0f, std::min(1.0f, d.confidence)) * 255.0f));
+      record.bbox = {to_i16(d.left), to_i16(d.top), to_i16(d.width), to_i16(d.height)};
+      frame.records.push_back(record);
+    }
+    auto keyframe = std::make_shared<std::string>();
+    encode(frame, nullptr, *keyframe);
+    frame.keyframe = std::move(keyframe);
+    return frame;
+  }
+
+  const Frame *find(uint32_t version) const {
+    for (const Frame &frame : history_) {
+      if (frame.keyframe && frame.version == version) {
+        return &frame;
+      }
+    }
+    return nullptr;
+  }
+
+  static void encode(const Frame &frame, const Frame *base, std::string &out) {
+    out.clear();
+    out.reserve(kHeaderBytes + frame.records.size() * kAbsoluteBytes);
+    out.append("ERMD", 4);
+    out += static_cast<char>(2);
+    out += static_cast<char>(base ? 1 : 0);
+    put_u16(out, static_cast<uint16_t>(frame.records.size()));
+    put_u16(out, frame.width);
+    put_u16(out, frame.height);
+    put_u32(out, frame.version);
+    put_u32(out, base ? base->version : 0);
+    for (const Record &record : frame.records) {
+      const int index = base ? find_record(*base, record) : -1;
+      if (index >= 0) {
+        const Record &prev = base->records[static_cast<size_t>(index)];
+        out += static_cast<char>(1);
+        put_u16(out, static_cast<uint16_t>(record.fixed_id));
+        out += static_cast<char>(index);
+        out += static_cast<char>(record.confidence);
+        for (size_t i = 0; i < record.bbox.size(); ++i) {
+          out += static_cast<char>(static_cast<int8_t>(record.bbox[i] - prev.bbox[i]));
+        }
+        continue;
+      }
+      out += static_cast<char>(0);
+      put_u16(out, static_cast<uint16_t>(record.fixed_id));
+      out += static_cast<char>(record.class_id);
+      out += static_cast<char>(record.confidence);
+      put_u64(out, record.tracking_id);
+      for (int16_t value : record.bbox) {
+        put_u16(out, static_cast<uint16_t>(value));
+      }
+    }
+  }
+
+  // 差分で送れる基準レコードの位置。なければ-1
+  static int find_record(const Frame &base, const Record &record) {
+    const size_t limit = std::min<size_t>(base.records.size(), 256);
+    for (size_t i = 0; i < limit; ++i) {
+      const Record &prev = base.records[i];
+      if (prev.tracking_id != record.tracking_id) {
+        continue;
+      }
+      if (prev.class_id != record.class_id) {
+        return -1;
+      }
+      for (size_t k = 0; k < record.bbox.size(); ++k) {
+        const int diff = record.bbox[k] - prev.bbox[k];
+        if (diff < -128 || diff > 127) {
+          return -1;
+        }
+      }
+      return static_cast<int>(i);
+    }
+    return -1;
+  }
+
+  const DetectionStore &store_;
+  std::mutex mutex_;
+  std::array<Frame, kHistory> history_;
+  size_t newest_ = 0;
+};
+
+// SSEのdata行にバイナリを載せるため（改行を含まない標準base64）
+void base64_encode(const std::string &data, std::string &out) {
+  static const char kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  out.reserve(out.size() + (data.size() + 2) / 3 * 4);
+  size_t i = 0;
+  for (; i + 2 < data.size(); i += 3) {
+    const uint32_t v = (static_cast<uint8_t>(data[i]) << 16) |
+                       (static_cast<uint8_t>(data[i + 1]) << 8) |
+                       static_cast<uint8_t>(data[i + 2]);
+    out += kAlphabet[(v >> 18) & 0x3f];
+    out += kAlphabet[(v >> 12) & 0x3f];
+    out += kAlphabet[(v >> 6) & 0x3f];
+    out += kAlphabet[v & 0x3f];
+  }
+  if (i < data.size()) {
+    uint32_t v = static_cast<uint8_t>(data[i]) << 16;
+    if (i + 1 < data.size()) {
+      v |= static_cast<uint8_t>(data[i + 1]) << 8;
+    }
+    out += kAlphabet[(v >> 18) & 0x3f];
+    out += kAlphabet[(v >> 12) & 0x3f];
+    out += i + 1 < data.size() ? kAlphabet[(v >> 6) & 0x3f] : '=';
+    out += '=';
+  }
+}
+
+bool send_all(int fd, const void *data, size_t len) {
+  const auto *ptr = static_cast<const uint8_t *>(data);
+  size_t remaining = len;
+  while (remaining > 0) {
+    ssize_t written = ::send(fd, ptr, remaining, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    ptr += written;
+    remaining -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+// 送り切るまで繰り返す（部分送信は続きから）
+bool send_iov(int fd, iovec *iov, int count) {
+  while (count > 0) {
+    msghdr msg {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = static_cast<size_t>(count);
+    const ssize_t written = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    size_t advance = static_cast<size_t>(written);
+    while (count > 0 && advance >= iov->iov_len) {
+      advance -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + advance;
+      iov->iov_len -= advance;
+    }
+  }
+  return true;
+}
+
+// /stream の配信。1本のepollスレッドで全クライアントを扱う。
+// ソケットはノンブロッキングで、パートヘッダ・JPEG・末尾の\r\nを
+// sendmsg()1回で送る。各クライアントは常に最新フレームだけを送り、
+// 送信中に届いたフレームはキューせずに読み飛ばす。
+// meta=1 のクライアントには、各JPEGパートの前にそのフレームの検出結果を
+// JSONパートとして送る（X-Frame-Sequenceで対応付け）。
+class MjpegStreamer {
+ public:
+  explicit MjpegStreamer(FrameStore &store) : store_(store) {}
+
+  ~MjpegStreamer() { stop(); }
+
+  bool start() {
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || event_fd_ < 0) {
+      std::cerr << "[stream] epoll/eventfd setup failed: "
+                << std::strerror(errno) << std::endl;
+      return false;
+    }
+    epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = event_fd_;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev);
+    store_.set_notify_fd(event_fd_);
+    thread_ = std::thread(&MjpegStreamer::run, this);
+    return true;
+  }
+
+  void stop() {
+    if (!thread_.joinable()) {
+      return;
+    }
+    stopping_ = true;
+    wake();
+    thread_.join();
+    store_.set_notify_fd(-1);
+    ::close(event_fd_);
+    ::close(epoll_fd_);
+  }
+
+  // acceptスレッドから呼ばれる。以降のソケット管理はepollスレッドが行う
+  void add_client(int fd, bool with_meta) {
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      pending_.push_back({fd, with_meta});
+    }
+    wake();
+  }
+
+ private:
+  static constexpr int kMaxEvents = 64;
+  static constexpr auto kStallTimeout = std::chrono::seconds(30);
+
+  struct Pending {
+    int fd;
+    bool with_meta;
+  };
+
+  struct Client {
+    int fd = -1;
+    bool with_meta = false;
+    JpegFramePtr frame;  // 送信中のフレーム（なければnullptr）
+    AnnotatedFramePtr annotated;  // meta=1: 送信中のJSON+フレーム
+    uint64_t cursor = 0;  // 最後に送り始めたフレームのsequence
+    std::string head;  // HTTPヘッダ（初回のみ）+ 最初のパートヘッダ
+    std::string mid;  // meta=1: JSONパートの後のJPEGパートヘッダ
+    size_t sent = 0;  // 今回のパート全体のうち送信済みのバイト数
+    bool want_write = false;  // EPOLLOUTを待っているか
+    std::chrono::steady_clock::time_point last_progress;
+  };
+
+  void wake() {
+    const uint64_t one = 1;
+    ssize_t ret = ::write(event_fd_, &one, sizeof(one));
+    (void)ret;
+  }
+
+  void run() {
+    epoll_event events[kMaxEvents];
+    while (!stopping_.load() && g_running.load()) {
+      const int n = ::epoll_wait(epoll_fd_, events, kMaxEvents, 500);
+      if (n < 0 && errno != EINTR) {
+        std::cerr << "[stream] epoll_wait failed: " << std::strerror(errno)
+                  << std::endl;
+        break;
+      }
+      bool woken = false;
+      for (int i = 0; i < n; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == event_fd_) {
+          uint64_t counter;
+          while (::read(event_fd_, &counter, sizeof(counter)) > 0) {
+          }
+          woken = true;
+          continue;
+        }
+        auto it = clients_.find(fd);
+        if (it == clients_.end()) {
+          continue;
+        }
+        if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+          close_client(fd);
+          continue;
+        }
+        if ((events[i].events & EPOLLIN) && !drain_input(fd)) {
+          close_client(fd);
+          continue;
+        }
+        if ((events[i].events & EPOLLOUT) && !flush(it->second)) {
+          close_client(fd);
+        }
+      }
+      if (woken) {
+        accept_pending();
+        latest_ = store_.latest(latest_sequence_);
+        latest_annotated_ = store_.latest_annotated(annotated_sequence_);
+        start_idle_clients();
+      }
+      drop_stalled_clients();
+    }
+    for (auto &entry : clients_) {
+      ::close(entry.first);
+      store_.remove_viewer(entry.second.with_meta);
+    }
+    clients_.clear();
+    latest_.reset();
+    latest_annotated_.reset();
+  }
+
+  void accept_pending() {
+    std::vector<Pending> added;
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      added.swap(pending_);
+    }
+    static const char kHeader[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Pragma: no-cache\r\n"
+        "Connection: close\r\n"
+        "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n";
+    for (const Pending &pending : added) {
+      const int fd = pending.fd;
+      const int flags = ::fcntl(fd, F_GETFL, 0);
+      ::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+      epoll_event ev {};
+      ev.events = EPOLLIN | EPOLLRDHUP;
+      ev.data.fd = fd;
+      if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ::close(fd);
+        continue;
+      }
+      store_.add_viewer(pending.with_meta);
+      Client &client = clients_[fd];
+      client.fd = fd;
+      client.with_meta = pending.with_meta;
+      client.head.assign(kHeader, sizeof(kHeader) - 1);
+      client.last_progress = std::chrono::steady_clock::now();
+      if (!flush(client)) {
+        close_client(fd);
+      }
+    }
+  }
+
+  bool has_newer(const Client &client) const {
+    if (client.with_meta) {
+      return latest_annotated_ && client.cursor != annotated_sequence_;
+    }
+    return latest_ && client.cursor != latest_sequence_;
+  }
+
+  void start_idle_clients() {
+    std::vector<int> failed;
+    for (auto &entry : clients_) {
+      Client &client = entry.second;
+      if (client.want_write || !has_newer(client)) {
+        continue;  // 送信中のクライアントは完了後に最新フレームへ進む
+      }
+      begin_frame(client);
+      if (!flush(client)) {
+        failed.push_back(entry.first);
+      }
+    }
+    for (int fd : failed) {
+      close_client(fd);
+    }
+  }
+
+  void begin_frame(Client &client) {
+    char part[128];
+    if (client.with_meta) {
+      client.annotated = latest_annotated_;
+      client.frame = client.annotated->frame;
+      client.cursor = annotated_sequence_;
+      int len = std::snprintf(part, sizeof(part),
+                              "--frame\r\n"
+                              "Content-Type: application/json\r\n"
+                              "X-Frame-Sequence: %llu\r\n"
+                              "Content-Length: %zu\r\n\r\n",
+                              static_cast<unsigned long long>(client.cursor),
+                              client.annotated->json.size());
+      client.head.assign(part, static_cast<size_t>(len));
+      len = std::snprintf(part, sizeof(part),
+                          "\r\n--frame\r\n"
+                          "Content-Type: image/jpeg\r\n"
+                          "X-Frame-Sequence: %llu\r\n"
+                          "Content-Length: %zu\r\n\r\n",
+                          static_cast<unsigned long long>(client.cursor),
+                          client.frame->size());
+      client.mid.assign(part, static_cast<size_t>(len));
+    } else {
+      client.frame = latest_;
+      client.cursor = latest_sequence_;
+      const int len = std::snprintf(part, sizeof(part),
+                                    "--frame\r\n"
+                                    "Content-Type: image/jpeg\r\n"
+                                    "Content-Length: %zu\r\n\r\n",
+                                    client.frame->size());
+      client.head.assign(part, static_cast<size_t>(len));
+    }
+    client.sent = 0;
+  }
+
+  // 書けるだけ書く。送信しきったら最新フレームがあれば続けて送る。
+  // falseは切断を意味する
+  bool flush(Client &client) {
+    static const char kTrailer[] = "\r\n";
+    for (;;) {
+      // head [+ JSON + mid] [+ JPEG + trailer]
+      iovec iov[5];
+      int count = 0;
+      auto append = [&](const void *data, size_t size) {
+        if (size > 0) {
+          iov[count].iov_base = const_cast<void *>(data);
+          iov[count].iov_len = size;
+          ++count;
+        }
+      };
+      append(client.head.data(), client.head.size());
+      if (client.annotated) {
+        append(client.annotated->json.data(), client.annotated->json.size());
+        append(client.mid.data(), client.mid.size());
+      }
+      if (client.frame) {
+        append(client.frame->data(), client.frame->size());
+        append(kTrailer, sizeof(kTrailer) - 1);
+      }
+
+      // 前回までに送った分を読み飛ばす
+      int first = 0;
+      size_t skip = client.sent;
+      while (first < count && skip >= iov[first].iov_len) {
+        skip -= iov[first].iov_len;
+        ++first;
+      }
+      if (first < count) {
+        iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + skip;
+        iov[first].iov_len -= skip;
+      }
+
+      while (first < count) {
+        msghdr msg {};
+        msg.msg_iov = iov + first;
+        msg.msg_iovlen = static_cast<size_t>(count - first);
+        const ssize_t written = ::sendmsg(client.fd, &msg, MSG_NOSIGNAL);
+        if (written < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return set_write_interest(client, true);
+          }
+          return false;
+        }
+        client.sent += static_cast<size_t>(written);
+        client.last_progress = std::chrono::steady_clock::now();
+        size_t advance = static_cast<size_t>(written);
+        while (first < count && advance >= iov[first].iov_len) {
+          advance -= iov[first].iov_len;
+          ++first;
+        }
+        if (first < count) {
+          iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + advance;
+          iov[first].iov_len -= advance;
+        }
+      }
+
+      // 送信完了。参照を手放し、より新しいフレームがあればそのまま続ける
+      client.frame.reset();
+      client.annotated.reset();
+      client.head.clear();
+      client.mid.clear();
+      client.sent = 0;
+      if (!has_newer(client)) {
+        return set_write_interest(client, false);
+      }
+      begin_frame(client);
+    }
+  }
+
+  bool set_write_interest(Client &client, bool enable) {
+    if (client.want_write == enable) {
+      return true;
+    }
+    epoll_event ev {};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    if (enable) {
+      ev.events |= EPOLLOUT;
+    }
+    ev.data.fd = client.fd;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, client.fd, &ev) < 0) {
+      return false;
+    }
+    client.want_write = enable;
+    return true;
+  }
+
+  // クライアントからの受信データは読み捨てる。0なら切断
+  static bool drain_input(int fd) {
+    char buffer[512];
+    for (;;) {
+      const ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+      if (n > 0) {
+        continue;
+      }
+      if (n == 0) {
+        return false;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+  }
+
+  void drop_stalled_clients() {
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<int> stalled;
+    for (const auto &entry : clients_) {
+      if (entry.second.want_write &&
+          now - entry.second.last_progress > kStallTimeout) {
+        stalled.push_back(entry.first);
+      }
+    }
+    for (int fd : stalled) {
+      close_client(fd);
+    }
+  }
+
+  void close_client(int fd) {
+    auto it = clients_.find(fd);
+    if (it == clients_.end()) {
+      return;
+    }
+    const bool with_meta = it->second.with_meta;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    clients_.erase(it);
+    store_.remove_viewer(with_meta);
+    if (clients_.empty()) {
+      latest_.reset();
+      latest_annotated_.reset();
+    }
+  }
+
+  FrameStore &store_;
+  std::thread thread_;
+  std::atomic<bool> stopping_{false};
+  int epoll_fd_ = -1;
+  int event_fd_ = -1;
+  std::mutex pending_mutex_;
+  std::vector<Pending> pending_;
+  // 以下はepollスレッドのみが触る
+  std::unordered_map<int, Client> clients_;
+  JpegFramePtr latest_;
+  uint64_t latest_sequence_ = 0;
+  AnnotatedFramePtr latest_annotated_;
+  uint64_t annotated_sequence_ = 0;
+};
+
+// /api/events のServer-Sent Events配信。1本のepollスレッドで全購読者を扱う。
+// detections / alerts / config の各チャネルは最新版のSSEフレームを1つだけ持ち、
+// 全購読者で共有する。送信中に更新された版は送らずに最新版へ進むので、
+// 遅いクライアントの分が溜まることはない。
+class EventStream {
+ public:
+  EventStream(DetectionStore &detection_store, int max_rate_hz)
+      : detection_store_(detection_store),
+        min_interval_(max_rate_hz > 0 ? std::chrono::microseconds(1000000 / max_rate_hz)
+                                      : std::chrono::microseconds(0)) {}
+
+  ~EventStream() { stop(); }
+
+  bool start() {
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || event_fd_ < 0) {
+      std::cerr << "[events] epoll/eventfd setup failed: "
+                << std::strerror(errno) << std::endl;
+      return false;
+    }
+    epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = event_fd_;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev);
+    thread_ = std::thread(&EventStream::run, this);
+    return true;
+  }
+
+  void stop() {
+    if (!thread_.joinable()) {
+      return;
+    }
+    stopping_ = true;
+    wake();
+    thread_.join();
+    accept_pending();  // スレッドが止まった後に渡された分を閉じる
+    ::close(event_fd_);
+    ::close(epoll_fd_);
+  }
+
+  // HTTPワーカーから呼ばれる。以降のソケット管理はepollスレッドが行う
+  // binaryなら検出結果はDetectionBinaryCacheの形式をbase64で送る（detections-bin）
+  void add_client(int fd, bool with_detections, bool binary) {
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      pending_.push_back({fd, with_detections, with_detections && binary});
+    }
+    wake();
+  }
+
+  // 検出結果を送る時刻か（購読者がいて、前回から最小間隔が経過している）
+  bool wants_detections() {
+    if (detection_clients_.load() == 0) {
+      return false;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    if (now < next_detections_) {
+      return false;
+    }
+    next_detections_ = now + min_interval_;
+    return true;
+  }
+
+  // jsonはDetectionJsonCacheの本文をそのまま共有する（コピーしない）。versionはその版
+  void publish_detections(std::shared_ptr<const std::string> json, uint64_t version,
+                          DetectionBinaryCache &binary) {
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      if (version == last_detections_version_) {
+        return;  // 変化がなければ送らない
+      }
+      last_detections_version_ = version;
+      pending_detections_ = make_shared_payload("detections", std::move(json));
+      if (binary_clients_.load() > 0) {
+        // 途中から受け取るクライアント用のキーフレームと、前回送った版からの差分
+        const auto key = binary.get(0);
+        const auto delta = binary.get(binary_version_);
+        pending_binary_key_ = make_binary_payload(key, ++version_counter_);
+        pending_binary_delta_ = delta.base != 0
+            ? make_binary_payload(delta, pending_binary_key_->version) : nullptr;
+        binary_version_ = key.version;
+      }
+    }
+    wake();
+  }
+
+  // アラート一覧・設定が変わったとき（DetectionStoreのロック解放後に呼ばれる）
+  void notify_state_changed() {
+    state_dirty_ = true;
+    wake();
+  }
+
+ private:
+  static constexpr int kMaxEvents = 64;
+  static constexpr auto kStallTimeout = std::chrono::seconds(30);
+  static constexpr auto kHeartbeatInterval = std::chrono::seconds(15);
+  static constexpr int kSendBufferBytes = 16 * 1024;
+
+  // 送信の優先順
+  enum Channel { kAlerts = 0, kConfig, kDetections, kChannelCount };
+
+  struct Payload {
+    uint64_t version = 0;
+    std::string data;  // "event: ...\ndata: ...\n\n"（bodyがあれば "event: ...\ndata: " まで）
+    std::shared_ptr<const std::string> body;  // 共有する本文。後に "\n\n" を付けて送る
+    uint32_t frame = 0;  // detections-bin: 復元後の版と差分の基準版
+    uint32_t base = 0;
+  };
+  using PayloadPtr = std::shared_ptr<const Payload>;
+
+  struct Pending {
+    int fd;
+    bool with_detections;
+    bool binary;
+  };
+
+  struct Client {
+    int fd = -1;
+    bool with_detections = true;
+    bool binary = false;
+    uint32_t binary_frame = 0;  // 最後に送ったdetections-binの版（差分の基準）
+    std::string head;  // HTTPヘッダ（初回のみ）
+    PayloadPtr payload;  // 送信中のイベント
+    size_t sent = 0;  // head + payload のうち送信済みのバイト数
+    std::array<uint64_t, kChannelCount> seen {};  // チャネルごとに最後に送った版
+    bool want_write = false;
+    std::chrono::steady_clock::time_point last_progress;
+    std::chrono::steady_clock::time_point last_sent;
+  };
+
+  PayloadPtr make_payload(const char *event, const std::string &json) {
+    auto payload = std::make_shared<Payload>();
+    payload->version = ++version_counter_;
+    payload->data.reserve(json.size() + 32);
+    payload->data.append("event: ").append(event).append("\ndata: ");
+    payload->data.append(json).append("\n\n");
+    return payload;
+  }
+
+  PayloadPtr make_shared_payload(const char *event, std::shared_ptr<const std::string> json) {
+    auto payload = std::make_shared<Payload>();
+    payload->version = ++version_counter_;
+    payload->data.append("event: ").append(event).append("\ndata: ");
+    payload->body = std::move(json);
+    return payload;
+  }
+
+  static PayloadPtr make_binary_payload(const DetectionBinaryCache::Encoded &encoded,
+                                        uint64_t version) {
+    auto payload = std::make_shared<Payload>();
+    payload->version = version;
+    payload->frame = encoded.version;
+    payload->base = encoded.base;
+    payload->data.reserve(encoded.data->size() * 4 / 3 + 40);
+    payload->data.append("event: detections-bin\ndata: ");
+    base64_encode(*encoded.data, payload->data);
+    payload->data.append("\n\n");
+    return payload;
+  }
+
+  void wake() {
+    const uint64_t one = 1;
+    ssize_t ret = ::write(event_fd_, &one, sizeof(one));
+    (void)ret;
+  }
+
+  void run() {
+    epoll_event events[kMaxEvents];
+    while (!stopping_.load() && g_running.load()) {
+      const int n = ::epoll_wait(epoll_fd_, events, kMaxEvents, 1000);
+      if (n < 0 && errno != EINTR) {
+        std::cerr << "[events] epoll_wait failed: " << std::strerror(errno)
+                  << std::endl;
+        break;
+      }
+      bool woken = false;
+      for (int i = 0; i < n; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == event_fd_) {
+          uint64_t counter;
+          while (::read(event_fd_, &counter, sizeof(counter)) > 0) {
+          }
+          woken = true;
+          continue;
+        }
+        auto it = clients_.find(fd);
+        if (it == clients_.end()) {
+          continue;
+        }
+        if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+          close_client(fd);
+          continue;
+        }
+        if ((events[i].events & EPOLLIN) && !drain_input(fd)) {
+          close_client(fd);
+          continue;
+        }
+        if ((events[i].events & EPOLLOUT) && !flush(it->second)) {
+          close_client(fd);
+        }
+      }
+      if (woken) {
+        accept_pending();
+        refresh_latest();
+      }
+      // 新しい版があるか、しばらく何も送っていないクライアントへ送る
+      start_idle_clients();
+      drop_stalled_clients();
+    }
+    for (auto &entry : clients_) {
+      ::close(entry.first);
+    }
+    clients_.clear();
+    detection_clients_ = 0;
+    binary_clients_ = 0;
+  }
+
+  void accept_pending() {
+    std::vector<Pending> added;
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      added.swap(pending_);
+    }
+    static const char kHeader[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n\r\n"
+        "retry: 2000\n\n";
+    const auto now = std::chrono::steady_clock::now();
+    for (const Pending &pending : added) {
+      const int fd = pending.fd;
+      const int flags = ::fcntl(fd, F_GETFL, 0);
+      ::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+      // カーネルの送信バッファに古い版が溜まると読み飛ばしが効かないので小さくする
+      const int sndbuf = kSendBufferBytes;
+      ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+      epoll_event ev {};
+      ev.events = EPOLLIN | EPOLLRDHUP;
+      ev.data.fd = fd;
+      if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ::close(fd);
+        continue;
+      }
+      Client &client = clients_[fd];
+      client.fd = fd;
+      client.with_detections = pending.with_detections;
+      client.binary = pending.binary;
+      client.head.assign(kHeader, sizeof(kHeader) - 1);
+      client.last_progress = now;
+      client.last_sent = now;
+      if (client.with_detections) {
+        detection_clients_++;
+      }
+      if (client.binary && binary_clients_++ == 0) {
+        // 最初のバイナリ購読者には検出結果に変化がなくても次のフレームで送る
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        last_detections_version_ = 0;
+      }
+    }
+    if (!added.empty()) {
+      state_dirty_ = true;  // 初回は現在の状態を作っておく
+    }
+  }
+
+  void refresh_latest() {
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      if (pending_detections_) {
+        latest_[kDetections] = std::move(pending_detections_);
+      }
+      if (pending_binary_key_) {
+        latest_binary_key_ = std::move(pending_binary_key_);
+        latest_binary_delta_ = std::move(pending_binary_delta_);
+      }
+    }
+    if (!state_dirty_.exchange(false) || clients_.empty()) {
+      return;
+    }
+    // アラートと設定はepollスレッドで直列化する（変化がなければ版を上げない）
+    const std::string alerts = alerts_to_json(*detection_store_.snapshot());
+    if (!latest_[kAlerts] || alerts != alerts_json_) {
+      alerts_json_ = alerts;
+      latest_[kAlerts] = make_payload("alerts", alerts);
+    }
+    const std::string config = std::string("{\"auto_register\":") +
+        (detection_store_.get_auto_register() ? "true" : "false") + "}";
+    if (!latest_[kConfig] || config != config_json_) {
+      config_json_ = config;
+      latest_[kConfig] = make_payload("config", config);
+    }
+  }
+
+  // 未送信の最新版を優先順に選ぶ
+  bool next_payload(Client &client) {
+    for (int channel = 0; channel < kChannelCount; ++channel) {
+      const PayloadPtr &latest = (channel == kDetections && client.binary)
+          ? binary_payload(client) : latest_[channel];
+      if (!latest || client.seen[channel] == latest->version ||
+          (channel == kDetections && !client.with_detections)) {
+        continue;
+      }
+      client.seen[channel] = latest->version;
+      if (client.binary && channel == kDetections) {
+        client.binary_frame = latest->frame;
+      }
+      client.payload = latest;
+      client.sent = 0;
+      return true;
+    }
+    return false;
+  }
+
+  // 手元の版が差分の基準と一致するクライアントにだけ差分を送る
+  const PayloadPtr &binary_payload(const Client &client) const {
+    if (latest_binary_delta_ && client.binary_frame == latest_binary_delta_->base) {
+      return latest_binary_delta_;
+    }
+    return latest_binary_key_;
+  }
+
+  void start_idle_clients() {
+    static const PayloadPtr kHeartbeat = [] {
+      auto payload = std::make_shared<Payload>();
+      payload->data = ": ping\n\n";
+      return payload;
+    }();
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<int> failed;
+    for (auto &entry : clients_) {
+      Client &client = entry.second;
+      if (client.want_write) {
+        continue;  // 送信中のクライアントは完了後に最新版へ進む
+      }
+      if (!client.head.empty() || next_payload(client)) {
+        // flushで送る
+      } else if (now - client.last_sent >= kHeartbeatInterval) {
+        client.payload = kHeartbeat;
+        client.sent = 0;
+      } else {
+        continue;
+      }
+      if (!flush(client)) {
+        failed.push_back(entry.first);
+      }
+    }
+    for (int fd : failed) {
+      close_client(fd);
+    }
+  }
+
+  // 書けるだけ書く。falseは切断を意味する
+  bool flush(Client &client) {
+    static const std::string kEventEnd = "\n\n";
+    for (;;) {
+      iovec iov[4];
+      int count = 0;
+      size_t skip = client.sent;
+      auto append = [&](const std::string &data) {
+        if (skip >= data.size()) {
+          skip -= data.size();
+          return;
+        }
+        iov[count].iov_base = const_cast<char *>(data.data()) + skip;
+        iov[count].iov_len = data.size() - skip;
+        skip = 0;
+        ++count;
+      };
+      append(client.head);
+      if (client.payload) {
+        append(client.payload->data);
+        if (client.payload->body) {
+          append(*client.payload->body);
+          append(kEventEnd);
+        }
+      }
+      if (count > 0) {
+        msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = static_cast<size_t>(count);
+        const ssize_t written = ::sendmsg(client.fd, &msg, MSG_NOSIGNAL);
+        if (written < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return set_write_interest(client, true);
+          }
+          return false;
+        }
+        client.sent += static_cast<size_t>(written);
+        client.last_progress = std::chrono::steady_clock::now();
+        continue;
+      }
+
+      // 送信完了。次の版があればそのまま続ける
+      client.head.clear();
+      client.payload.reset();
+      client.sent = 0;
+      client.last_sent = client.last_progress;
+      if (!next_payload(client)) {
+        return set_write_interest(client, false);
+      }
+    }
+  }
+
+  bool set_write_interest(Client &client, bool enable) {
+    if (client.want_write == enable) {
+      return true;
+    }
+    epoll_event ev {};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    if (enable) {
+      ev.events |= EPOLLOUT;
+    }
+    ev.data.fd = client.fd;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, client.fd, &ev) < 0) {
+      return false;
+    }
+    client.want_write = enable;
+    return true;
+  }
+
+  // クライアントからの受信データは読み捨てる。0なら切断
+  static bool drain_input(int fd) {
+    char buffer[512];
+    for (;;) {
+      const ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+      if (n > 0) {
+        continue;
+      }
+      if (n == 0) {
+        return false;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+  }
+
+  void drop_stalled_clients() {
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<int> stalled;
+    for (const auto &entry : clients_) {
+      if (entry.second.want_write &&
+          now - entry.second.last_progress > kStallTimeout) {
+        stalled.push_back(entry.first);
+      }
+    }
+    for (int fd : stalled) {
+      close_client(fd);
+    }
+  }
+
+  void close_client(int fd) {
+    auto it = clients_.find(fd);
+    if (it == clients_.end()) {
+      return;
+    }
+    if (it->second.with_detections && --detection_clients_ == 0) {
+      // 次の購読者に古い検出結果を送らないよう捨てる
+      latest_[kDetections].reset();
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      pending_detections_.reset();
+      last_detections_version_ = 0;
+    }
+    if (it->second.binary && --binary_clients_ == 0) {
+      latest_binary_key_.reset();
+      latest_binary_delta_.reset();
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      pending_binary_key_.reset();
+      pending_binary_delta_.reset();
+      binary_version_ = 0;
+    }
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    clients_.erase(it);
+  }
+
+  DetectionStore &detection_store_;
+  const std::chrono::microseconds min_interval_;
+  std::thread thread_;
+  std::atomic<bool> stopping_{false};
+  std::atomic<bool> state_dirty_{true};
+  std::atomic<int> detection_clients_{0};
+  std::atomic<int> binary_clients_{0};
+  int epoll_fd_ = -1;
+  int event_fd_ = -1;
+  std::mutex pending_mutex_;
+  std::vector<Pending> pending_;
+  PayloadPtr pending_detections_;
+  PayloadPtr pending_binary_key_;
+  PayloadPtr pending_binary_delta_;
+  uint32_t binary_version_ = 0;  // 前回publishしたバイナリの版
+  uint64_t last_detections_version_ = 0;  // 前回publishした検出結果の版（0 = なし）
+  std::chrono::steady_clock::time_point next_detections_;
+  std::atomic<uint64_t> version_counter_{0};
+  // 以下はepollスレッドのみが触る
+  std::unordered_map<int, Client> clients_;
+  std::array<PayloadPtr, kChannelCount> latest_;
+  PayloadPtr latest_binary_key_;
+  PayloadPtr latest_binary_delta_;
+  std::string alerts_json_;
+  std::string config_json_;
+};
+
+// JPEGのSOFマーカーから画像サイズを取得する
+bool jpeg_dimensions(const uint8_t *data, size_t size, int &width, int &height) {
+  size_t pos = 2;  // SOIの後
+  while (pos + 9 < size) {
+    if (data[pos] != 0xFF) {
+      return false;
+    }
+    const uint8_t marker = data[pos + 1];
+    const size_t length = (static_cast<size_t>(data[pos + 2]) << 8) | data[pos + 3];
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 &&
+        marker != 0xCC) {
+      height = (data[pos + 5] << 8) | data[pos + 6];
+      width = (data[pos + 7] << 8) | data[pos + 8];
+      return true;
+    }
+    pos += 2 + length;
+  }
+  return false;
+}
+
+// MJPEG-in-AVI（RIFF）の書き出し。ヘッダは最後にサイズ確定後に書き直す
+class MjpegAviWriter {
+ public:
+  bool open(const std::string &path) {
+    out_.open(path, std::ios::binary | std::ios::trunc);
+    if (!out_) {
+      return false;
+    }
+    index_.clear();
+    movi_bytes_ = 4;  // "movi"
+    max_frame_ = 0;
+    const std::string placeholder(kHeaderSize, '\0');
+    out_.write(placeholder.data(), placeholder.size());
+    return static_cast<bool>(out_);
+  }
+
+  bool add_frame(const uint8_t *data, size_t size) {
+    static const char kPad[1] = {0};
+    IndexEntry entry;
+    entry.offset = movi_bytes_;
+    entry.size = static_cast<uint32_t>(size);
+    std::string chunk = "00dc";
+    put32(chunk, static_cast<uint32_t>(size));
+    out_.write(chunk.data(), chunk.size());
+    out_.write(reinterpret_cast<const char *>(data), size);
+    if (size & 1) {
+      out_.write(kPad, 1);
+    }
+    movi_bytes_ += 8 + static_cast<uint32_t>((size + 1) & ~static_cast<size_t>(1));
+    max_frame_ = std::max(max_frame_, entry.size);
+    index_.push_back(entry);
+    return static_cast<bool>(out_);
+  }
+
+  bool finish(int width, int height, double fps) {
+    std::string idx1 = "idx1";
+    put32(idx1, static_cast<uint32_t>(index_.size() * 16));
+    for (const IndexEntry &entry : index_) {
+      idx1 += "00dc";
+      put32(idx1, 0x10);  // AVIIF_KEYFRAME
+      put32(idx1, entry.offset);
+      put32(idx1, entry.size);
+    }
+    out_.write(idx1.data(), idx1.size());
+
+    const uint32_t frames = static_cast<uint32_t>(index_.size());
+    const uint32_t usec_per_frame =
+        static_cast<uint32_t>(1000000.0 / (fps > 0.0 ? fps : 30.0));
+    const uint32_t riff_size = 4 + (8 + 192) + (8 + movi_bytes_) +
+                               static_cast<uint32_t>(idx1.size());
+
+    std::string header;
+    header += "RIFF";
+    put32(header, riff_size);
+    header += "AVI LIST";
+    put32(header, 192);
+    header += "hdrlavih";
+    put32(header, 56);
+    put32(header, usec_per_frame);
+    put32(header, 0);  // dwMaxBytesPerSec
+    put32(header, 0);  // dwPaddingGranularity
+    put32(header, 0x10);  // AVIF_HASINDEX
+    put32(header, frames);
+    put32(header, 0);  // dwInitialFrames
+    put32(header, 1);  // dwStreams
+    put32(header, max_frame_);
+    put32(header, static_cast<uint32_t>(width));
+    put32(header, static_cast<uint32_t>(height));
+    header.append(16, '\0');  // dwReserved[4]
+    header += "LIST";
+    put32(header, 116);
+    header += "strlstrh";
+    put32(header, 56);
+    header += "vidsMJPG";
+    put32(header, 0);  // dwFlags
+    put32(header, 0);  // wPriority, wLanguage
+    put32(header, 0);  // dwInitialFrames
+    put32(header, usec_per_frame);  // dwScale
+    put32(header, 1000000);  // dwRate
+    put32(header, 0);  // dwStart
+    put32(header, frames);  // dwLength
+    put32(header, max_frame_);
+    put32(header, 0xFFFFFFFF);  // dwQuality
+    put32(header, 0);  // dwSampleSize
+    put16(header, 0);
+    put16(header, 0);
+    put16(header, static_cast<uint16_t>(width));
+    put16(header, static_cast<uint16_t>(height));
+    header += "strf";
+    put32(header, 40);
+    put32(header, 40);  // biSize
+    put32(header, static_cast<uint32_t>(width));
+    put32(header, static_cast<uint32_t>(height));
+    put16(header, 1);  // biPlanes
+    put16(header, 24);  // biBitCount
+    header += "MJPG";
+    put32(header, static_cast<uint32_t>(width * height * 3));
+    header.append(16, '\0');  // biXPelsPerMeter .. biClrImportant
+    header += "LIST";
+    put32(header, movi_bytes_);
+    header += "movi";
+
+    out_.seekp(0);
+    out_.write(header.data(), header.size());
+    out_.close();
+    return !out_.fail();
+  }
+
+ private:
+  static constexpr size_t kHeaderSize = 224;  // RIFF + hdrl + "LIST....movi"
+
+  struct IndexEntry {
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  static void put16(std::string &out, uint16_t v) {
+    out += static_cast<char>(v & 0xFF);
+    out += static_cast<char>((v >> 8) & 0xFF);
+  }
+
+  static void put32(std::string &out, uint32_t v) {
+    put16(out, static_cast<uint16_t>(v & 0xFFFF));
+    put16(out, static_cast<uint16_t>(v >> 16));
+  }
+
+  std::ofstream out_;
+  std::vector<IndexEntry> index_;
+  uint32_t movi_bytes_ = 4;
+  uint32_t max_frame_ = 0;
+};
+
+// アラート前後の映像クリップ。直近のJPEGと検出結果を起動時に確保したアリーナへ
+// リングバッファとして保持し（定常状態で確保なし）、転倒/ベッド落下のアラートが
+// 出たら書き出しスレッドがプリロール+ポストロールをMJPEG-AVIで保存する。
+// サンプルスレッドがロックを持つのは1フレームのmemcpyの間だけ。
+class ClipRecorder {
+ public:
+  enum class ClipState { Unknown, Recording, Ready, Failed };
+
+  struct Config {
+    size_t memory_bytes = 0;  // 0なら無効
+    int pre_seconds = 10;
+    int post_seconds = 5;
+    std::string directory;
+  };
+
+  explicit ClipRecorder(const Config &config) : config_(config) {
+    if (config_.memory_bytes == 0) {
+      return;
+    }
+    arena_.resize(config_.memory_bytes);
+    const size_t frames = static_cast<size_t>(
+        (config_.pre_seconds + config_.post_seconds + 2) * kMaxFps);
+    slots_.resize(std::max<size_t>(frames, 16));
+  }
+
+  ~ClipRecorder() { stop(); }
+
+  bool enabled() const { return !arena_.empty(); }
+
+  bool start() {
+    if (!enabled()) {
+      return false;
+    }
+    if (::mkdir(config_.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+      std::cerr << "[clip] Cannot create " << config_.directory << ": "
+                << std::strerror(errno) << std::endl;
+      return false;
+    }
+    writer_ = std::thread(&ClipRecorder::writer_loop, this);
+    std::cout << "[clip] Keeping " << config_.pre_seconds << "s before / "
+              << config_.post_seconds << "s after alerts ("
+              << (config_.memory_bytes >> 20) << " MB ring) in "
+              << config_.directory << std::endl;
+    return true;
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(job_mutex_);
+      stopping_ = true;
+    }
+    job_cond_.notify_all();
+    if (writer_.joinable()) {
+      writer_.join();
+    }
+  }
+
+  // metaスレッドから: 次に記録するフレームに付ける検出結果
+  void set_detections(const std::vector<DetectionStore::DetectionWithFixedId> &detections) {
+    std::lock_guard<std::mutex> lock(ring_mutex_);
+    latest_count_ = std::min(detections.size(), kMaxDetections);
+    for (size_t i = 0; i < latest_count_; ++i) {
+      latest_[i] = detections[i];
+    }
+  }
+
+  // sampleスレッドから: JPEGをアリーナへコピーし、上書きされる古いフレームを捨てる
+  void add_frame(const JpegFrame &frame) {
+    const size_t size = frame.size();
+    if (size == 0 || size > arena_.size() / 4) {
+      return;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(ring_mutex_);
+    size_t offset = write_offset_;
+    if (offset + size > arena_.size()) {
+      // 末尾の余りに残っている最古のフレームを捨てて先頭へ戻る
+      while (count_ > 0 && slots_[first_].offset >= write_offset_) {
+        drop_oldest();
+      }
+      offset = 0;
+    }
+    while (count_ > 0) {
+      const Slot &oldest = slots_[first_];
+      const bool overlaps = oldest.offset < offset + size &&
+                            offset < oldest.offset + oldest.size;
+      if (!overlaps && count_ < slots_.size()) {
+        break;
+      }
+      drop_oldest();
+    }
+    std::memcpy(arena_.data() + offset, frame.data(), size);
+    Slot &slot = slots_[(first_ + count_) % slots_.size()];
+    slot.offset = offset;
+    slot.size = size;
+    slot.timestamp = now;
+    slot.detection_count = latest_count_;
+    std::copy(latest_.begin(), latest_.begin() + latest_count_,
+              slot.detections.begin());
+    ++count_;
+    write_offset_ = offset + size;
+  }
+
+  // DetectionStoreのアラートリスナー（DetectionStoreのロック解放後に呼ばれる）
+  void on_alert(const Alert &alert) {
+    if (alert.type != ALERT_FALL && alert.type != ALERT_BED_FALL) {
+      return;
+    }
+    Job job;
+    job.alert_id = alert.id;
+    job.fixed_id = alert.fixed_id;
+    job.type = alert.type;
+    job.alert_time = alert.timestamp;
+    job.start = alert.timestamp - std::chrono::seconds(config_.pre_seconds);
+    job.end = alert.timestamp + std::chrono::seconds(config_.post_seconds);
+    {
+      std::lock_guard<std::mutex> lock(job_mutex_);
+      jobs_.push_back(job);
+      clips_[alert.id] = ClipState::Recording;
+    }
+    job_cond_.notify_all();
+  }
+
+  ClipState state(uint64_t alert_id, std::string &path) const {
+    std::lock_guard<std::mutex> lock(job_mutex_);
+    auto it = clips_.find(alert_id);
+    if (it == clips_.end()) {
+      return ClipState::Unknown;
+    }
+    path = clip_path(alert_id, ".avi");
+    return it->second;
+  }
+
+ private:
+  static constexpr int kMaxFps = 30;
+  static constexpr size_t kMaxDetections = 16;
+  static constexpr size_t kMaxClips = 32;  // これを超えたら古いクリップから削除
+
+  struct Slot {
+    size_t offset = 0;
+    size_t size = 0;
+    std::chrono::steady_clock::time_point timestamp;
+    size_t detection_count = 0;
+    std::array<DetectionStore::DetectionWithFixedId, kMaxDetections> detections;
+  };
+
+  struct Job {
+    uint64_t alert_id;
+    int fixed_id;
+    AlertType type;
+    std::chrono::steady_clock::time_point alert_time;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+  };
+
+  enum class CopyResult { Copied, Evicted, NotYet };
+
+  void drop_oldest() {
+    first_ = (first_ + 1) % slots_.size();
+    --count_;
+    ++first_sequence_;
+  }
+
+  std::string clip_path(uint64_t alert_id, const char *extension) const {
+    return config_.directory + "/alert_" + std::to_string(alert_id) + extension;
+  }
+
+  uint64_t find_sequence(std::chrono::steady_clock::time_point t) const {
+    std::lock_guard<std::mutex> lock(ring_mutex_);
+    for (size_t i = 0; i < count_; ++i) {
+      if (slots_[(first_ + i) % slots_.size()].timestamp >= t) {
+        return first_sequence_ + i;
+      }
+    }
+    return first_sequence_ + count_;
+  }
+
+  // 1フレームだけロックしてコピーする（サンプルスレッドを待たせない）
+  CopyResult copy_frame(uint64_t &sequence, std::vector<uint8_t> &jpeg,
+                        Slot &info) const {
+    std::lock_guard<std::mutex> lock(ring_mutex_);
+    if (sequence < first_sequence_) {
+      sequence = first_sequence_;
+      return CopyResult::Evicted;
+    }
+    if (sequence >= first_sequence_ + count_) {
+      return CopyResult::NotYet;
+    }
+    const Slot &slot =
+        slots_[(first_ + (sequence - first_sequence_)) % slots_.size()];
+    jpeg.assign(arena_.data() + slot.offset,
+                arena_.data() + slot.offset + slot.size);
+    info = slot;
+    return CopyResult::Copied;
+  }
+
+  void writer_loop() {
+    std::unique_lock<std::mutex> lock(job_mutex_);
+    for (;;) {
+      if (jobs_.empty()) {
+        if (stopping_) {
+          return;
+        }
+        job_cond_.wait(lock);
+        continue;
+      }
+      // 終了時はポストロールを待たずに書き出す
+      const auto deadline = jobs_.front().end;
+      if (!stopping_ && std::chrono::steady_clock::now() < deadline) {
+        job_cond_.wait_until(lock, deadline);
+        continue;
+      }
+      const Job job = jobs_.front();
+      jobs_.pop_front();
+      lock.unlock();
+      const bool ok = export_clip(job);
+      lock.lock();
+      clips_[job.alert_id] = ok ? ClipState::Ready : ClipState::Failed;
+      while (clips_.size() > kMaxClips) {
+        const uint64_t oldest = clips_.begin()->first;
+        ::unlink(clip_path(oldest, ".avi").c_str());
+        ::unlink(clip_path(oldest, ".json").c_str());
+        clips_.erase(clips_.begin());
+      }
+    }
+  }
+
+  bool export_clip(const Job &job) {
+    const std::string avi_path = clip_path(job.alert_id, ".avi");
+    const std::string tmp_path = avi_path + ".tmp";
+    MjpegAviWriter writer;
+    std::ofstream meta(clip_path(job.alert_id, ".json"), std::ios::trunc);
+    if (!writer.open(tmp_path) || !meta) {
+      std::cerr << "[clip] Cannot write " << tmp_path << std::endl;
+      return false;
+    }
+    // サイドカーJSON（/api/alerts/<id>/clip と同じ名前の.json）
+    meta_json_.clear();
+    meta_json_.begin_object()
+        .key("alert_id").value(job.alert_id)
+        .key("fixed_id").value(job.fixed_id)
+        .key("type").value(static_cast<int>(job.type))
+        .key("frames").begin_array();
+
+    uint64_t sequence = find_sequence(job.start);
+    size_t frames = 0;
+    bool pre_roll_lost = false;
+    int width = 0;
+    int height = 0;
+    std::chrono::steady_clock::time_point first_time;
+    std::chrono::steady_clock::time_point last_time;
+    for (;; ++sequence) {
+      const CopyResult result = copy_frame(sequence, jpeg_, frame_info_);
+      if (result == CopyResult::NotYet) {
+        break;
+      }
+      if (result == CopyResult::Evicted) {
+        pre_roll_lost = true;  // 書き出し中に上書きされた
+        --sequence;
+        continue;
+      }
+      if (frame_info_.timestamp > job.end) {
+        break;
+      }
+      if (frames == 0) {
+        first_time = frame_info_.timestamp;
+        jpeg_dimensions(jpeg_.data(), jpeg_.size(), width, height);
+      }
+      last_time = frame_info_.timestamp;
+      writer.add_frame(jpeg_.data(), jpeg_.size());
+
+      const auto t_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+          frame_info_.timestamp - job.alert_time).count();
+      meta_json_.begin_object()
+          .key("t_ms").value(static_cast<int64_t>(t_ms))
+          .key("detections").begin_array();
+      for (size_t i = 0; i < frame_info_.detection_count; ++i) {
+        const auto &d = frame_info_.detections[i].detection;
+        meta_json_.begin_object()
+            .key("fixed_id").value(frame_info_.detections[i].fixed_id)
+            .key("nvtracker_id").value(d.tracking_id)
+            .key("confidence").value(d.confidence)
+            .key("bbox").begin_object()
+            .key("left").value(d.left)
+            .key("top").value(d.top)
+            .key("width").value(d.width)
+            .key("height").value(d.height)
+            .end_object()
+            .end_object();
+      }
+      meta_json_.end_array().end_object();
+      ++frames;
+    }
+    meta_json_.end_array().end_object();
+    meta.write(meta_json_.str().data(), static_cast<std::streamsize>(meta_json_.str().size()));
+    meta.close();
+
+    if (frames == 0) {
+      std::cerr << "[clip] No frames buffered for alert " << job.alert_id << std::endl;
+      ::unlink(tmp_path.c_str());
+      return false;
+    }
+    if (first_time - job.start > std::chrono::milliseconds(200)) {
+      pre_roll_lost = true;  // アラート前の映像がリングに残っていなかった
+    }
+    const double seconds =
+        std::chrono::duration<double>(last_time - first_time).count();
+    const double fps = (frames > 1 && seconds > 0.0) ? (frames - 1) / seconds : 0.0;
+    if (!writer.finish(width, height, fps) ||
+        std::rename(tmp_path.c_str(), avi_path.c_str()) != 0) {
+      std::cerr << "[clip] Failed to write " << avi_path << std::endl;
+      ::unlink(tmp_path.c_str());
+      return false;
+    }
+    std::cout << "[clip] Saved " << avi_path << " (" << frames << " frames"
+              << (pre_roll_lost ? ", pre-roll incomplete - raise APP_CLIP_MEMORY_MB" : "")
+              << ")" << std::endl;
+    return true;
+  }
+
+  const Config config_;
+
+  // リングバッファ（ring_mutex_）
+  mutable std::mutex ring_mutex_;
+  std::vector<uint8_t> arena_;
+  std::vector<Slot> slots_;
+  size_t first_ = 0;  // 最古のスロット
+  size_t count_ = 0;
+  uint64_t first_sequence_ = 0;  // slots_[first_]の通し番号
+  size_t write_offset_ = 0;
+  std::array<DetectionStore::DetectionWithFixedId, kMaxDetections> latest_;
+  size_t latest_count_ = 0;
+
+  // 書き出しジョブ（job_mutex_）
+  mutable std::mutex job_mutex_;
+  std::condition_variable job_cond_;
+  std::deque<Job> jobs_;
+  std::map<uint64_t, ClipState> clips_;
+  bool stopping_ = false;
+  std::thread writer_;
+
+  // 書き出しスレッド専用
+  std::vector<uint8_t> jpeg_;
+  Slot frame_info_;
+  JsonWriter meta_json_;  // サイドカーJSON
+};
+
+ClipRecorder::Config clip_config_from_env() {
+  ClipRecorder::Config config;
+  const int memory_mb = env_int("APP_CLIP_MEMORY_MB", 32);
+  config.memory_bytes = memory_mb > 0 ? static_cast<size_t>(memory_mb) << 20 : 0;
+  config.pre_seconds = std::max(0, env_int("APP_CLIP_PRE_SEC", 10));
+  config.post_seconds = std::max(0, env_int("APP_CLIP_POST_SEC", 5));
+  const char *dir = std::getenv("APP_CLIP_DIR");
+  config.directory = (dir && *dir) ? dir : "/workspace/edge-room-monitor/clips";
+  return config;
+}
+
+// 簡易JSONから整数フィールドを取り出す（{"nvtracker_id":123} など）。なければfalse。
+// int64_tに収まるよう18桁まで（それより長い値もfalse）
+bool parse_json_int(std::string_view json, std::string_view key, int64_t &value) {
+  size_t pos = 0;
+  while ((pos = json.find(key, pos)) != std::string_view::npos) {
+    const size_t end = pos + key.size();
+    if (pos > 0 && json[pos - 1] == '"' && end < json.size() && json[end] == '"') {
+      break;
+    }
+    pos = end;
+  }
+  if (pos == std::string_view::npos) {
+    return false;
+  }
+  pos = json.find(':', pos + key.size() + 1);
+  if (pos == std::string_view::npos) {
+    return false;
+  }
+  pos++;
+  while (pos < json.size() && std::isspace(static_cast<unsigned char>(json[pos]))) {
+    pos++;
+  }
+  const bool negative = pos < json.size() && json[pos] == '-';
+  if (negative) {
+    pos++;
+  }
+  if (pos >= json.size() || !std::isdigit(static_cast<unsigned char>(json[pos]))) {
+    return false;
+  }
+  constexpr int kMaxDigits = 18;
+  int64_t result = 0;
+  int digits = 0;
+  while (pos < json.size() && std::isdigit(static_cast<unsigned char>(json[pos]))) {
+    if (++digits > kMaxDigits) {
+      return false;
+    }
+    result = result * 10 + (json[pos] - '0');
+    pos++;
+  }
+  value = negative ? -result : result;
+  return true;
+}
+
+// /api/alerts/{id}/clip
+// 符号なし10進数（19桁まで）
+bool parse_decimal(std::string_view text, uint64_t &value) {
+  if (text.empty() || text.size() > 19 ||
+      text.find_first_not_of("0123456789") != std::string_view::npos) {
+    return false;
+  }
+  value = 0;
+  for (char c : text) {
+    value = value * 10 + static_cast<uint64_t>(c - '0');
+  }
+  return true;
+}
+
+bool parse_clip_path(std::string_view path, uint64_t &alert_id) {
+  constexpr std::string_view kPrefix = "/api/alerts/";
+  constexpr std::string_view kSuffix = "/clip";
+  if (path.size() <= kPrefix.size() + kSuffix.size() ||
+      path.substr(0, kPrefix.size()) != kPrefix ||
+      path.substr(path.size() - kSuffix.size()) != kSuffix) {
+    return false;
+  }
+  return parse_decimal(path.substr(kPrefix.size(),
+                                   path.size() - kPrefix.size() - kSuffix.size()),
+                       alert_id);
+}
+
+// アラートクリップのダウンロード。1本のepollスレッドがノンブロッキングのsendfile()で
+// 全転送を進めるので、遅いクライアントがHTTPワーカーを塞がない。
+// 同時転送はkMaxTransfersまでで、超えた分は呼び出し側が503を返す。
+class ClipSender {
+ public:
+  static constexpr size_t kMaxTransfers = 8;
+
+  enum class Start {
+    Started,   // 転送を引き受けた。client_fdの所有権も渡った
+    NotFound,  // ファイルを開けなかった（何も送っていない）
+    Busy,      // 同時転送数の上限（何も送っていない）
+  };
+
+  ~ClipSender() { stop(); }
+
+  bool start() {
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || event_fd_ < 0) {
+      std::cerr << "[clip] epoll/eventfd setup failed: " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = event_fd_;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev);
+    thread_ = std::thread(&ClipSender::run, this);
+    started_ = true;
+    return true;
+  }
+
+  void stop() {
+    if (!thread_.joinable()) {
+      return;
+    }
+    stopping_ = true;
+    wake();
+    thread_.join();
+    ::close(event_fd_);
+    ::close(epoll_fd_);
+  }
+
+  // HTTPワーカーから呼ばれる。ファイルを開いてヘッダを作り、送信はepollスレッドに任せる
+  Start send(int client_fd, const std::string &path, const char *content_type) {
+    if (!started_.load() || stopping_.load()) {
+      return Start::Busy;
+    }
+    if (active_.fetch_add(1) >= kMaxTransfers) {
+      active_.fetch_sub(1);
+      return Start::Busy;
+    }
+    const int file_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st {};
+    if (file_fd < 0 || ::fstat(file_fd, &st) != 0) {
+      if (file_fd >= 0) {
+        ::close(file_fd);
+      }
+      active_.fetch_sub(1);
+      return Start::NotFound;
+    }
+    Transfer transfer;
+    transfer.client_fd = client_fd;
+    transfer.file_fd = file_fd;
+    transfer.size = st.st_size;
+    const std::string filename = path.substr(path.find_last_of('/') + 1);
+    std::ostringstream oss;
+    oss << "HTTP/1.1 200 OK\r\n"
+        << "Content-Type: " << content_type << "\r\n"
+        << "Content-Length: " << st.st_size << "\r\n"
+        << "Content-Disposition: inline; filename=\"" << filename << "\"\r\n"
+        << "Access-Control-Allow-Origin: *\r\n"
+        << "Connection: close\r\n\r\n";
+    transfer.header = oss.str();
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      pending_.push_back(std::move(transfer));
+    }
+    wake();
+    return Start::Started;
+  }
+
+  size_t active() const { return active_.load(); }
+
+ private:
+  static constexpr int kMaxEvents = 16;
+  static constexpr auto kStallTimeout = std::chrono::seconds(30);
+
+  struct Transfer {
+    int client_fd = -1;
+    int file_fd = -1;
+    std::string header;
+    size_t header_sent = 0;
+    off_t offset = 0;
+    off_t size = 0;
+    std::chrono::steady_clock::time_point last_progress;
+  };
+
+  void wake() {
+    const uint64_t one = 1;
+    ssize_t ret = ::write(event_fd_, &one, sizeof(one));
+    (void)ret;
+  }
+
+  void run() {
+    epoll_event events[kMaxEvents];
+    while (!stopping_.load() && g_running.load()) {
+      const int n = ::epoll_wait(epoll_fd_, events, kMaxEvents, 500);
+      if (n < 0 && errno != EINTR) {
+        std::cerr << "[clip] epoll_wait failed: " << std::strerror(errno) << std::endl;
+        break;
+      }
+      for (int i = 0; i < n; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == event_fd_) {
+          uint64_t counter;
+          while (::read(event_fd_, &counter, sizeof(counter)) > 0) {
+          }
+          accept_pending();
+          continue;
+        }
+        auto it = transfers_.find(fd);
+        if (it == transfers_.end()) {
+          continue;
+        }
+        if ((events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) || !flush(it->second)) {
+          finish(fd);
+        }
+      }
+      drop_stalled();
+    }
+    accept_pending();
+    while (!transfers_.empty()) {
+      finish(transfers_.begin()->first);
+    }
+  }
+
+  void accept_pending() {
+    std::vector<Transfer> added;
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      added.swap(pending_);
+    }
+    for (Transfer &transfer : added) {
+      const int fd = transfer.client_fd;
+      const int flags = ::fcntl(fd, F_GETFL, 0);
+      ::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+      transfer.last_progress = std::chrono::steady_clock::now();
+      transfers_[fd] = std::move(transfer);
+      epoll_event ev {};
+      ev.events = EPOLLOUT | EPOLLRDHUP;
+      ev.data.fd = fd;
+      if (stopping_.load() || ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0 ||
+          !flush(transfers_[fd])) {
+        finish(fd);
+      }
+    }
+  }
+
+  // 書けるだけ書く。送り終えたか切断されたらfalse（どちらも接続を閉じる）
+  static bool flush(Transfer &transfer) {
+    while (transfer.header_sent < transfer.header.size()) {
+      const ssize_t n = ::send(transfer.client_fd, transfer.header.data() + transfer.header_sent,
+                               transfer.header.size() - transfer.header_sent, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return true;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      transfer.header_sent += static_cast<size_t>(n);
+      transfer.last_progress = std::chrono::steady_clock::now();
+    }
+    while (transfer.offset < transfer.size) {
+      const ssize_t n = ::sendfile(transfer.client_fd, transfer.file_fd, &transfer.offset,
+                                   static_cast<size_t>(transfer.size - transfer.offset));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return true;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      transfer.last_progress = std::chrono::steady_clock::now();
+    }
+    return false;
+  }
+
+  void drop_stalled() {
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<int> stalled;
+    for (const auto &entry : transfers_) {
+      if (now - entry.second.last_progress > kStallTimeout) {
+        stalled.push_back(entry.first);
+      }
+    }
+    for (int fd : stalled) {
+      finish(fd);
+    }
+  }
+
+  void finish(int fd) {
+    auto it = transfers_.find(fd);
+    if (it == transfers_.end()) {
+      return;
+    }
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(it->second.file_fd);
+    ::close(fd);
+    transfers_.erase(it);
+    active_.fetch_sub(1);
+  }
+
+  std::thread thread_;
+  std::atomic<bool> started_{false};
+  std::atomic<bool> stopping_{false};
+  std::atomic<size_t> active_{0};
+  int epoll_fd_ = -1;
+  int event_fd_ = -1;
+  std::mutex pending_mutex_;
+  std::vector<Transfer> pending_;
+  // 以下はepollスレッドのみが触る
+  std::unordered_map<int, Transfer> transfers_;
+};
+
+bool iequals(std::string_view a, std::string_view b) {
+  return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// パース済みのHTTPリクエスト。各フィールドは受信バッファを指すだけでコピーしない
+// （バッファより長く保持しないこと）
+struct HttpRequest {
+  static constexpr size_t kMaxHeaders = 32;
+
+  struct Header {
+    std::string_view name;
+    std::string_view value;
+  };
+
+  std::string_view method;
+  std::string_view target;  // パス + クエリ
+  std::string_view path;
+  std::string_view query;   // '?'より後（なければ空）
+  std::array<Header, kMaxHeaders> headers;
+  size_t header_count = 0;
+  std::string_view body;
+  size_t length = 0;  // ヘッダ + 本文のバイト数
+  bool keep_alive = true;
+  bool wait_expired = false;  // 長ポーリングの待ち時間を使い切った（HttpServerが設定）
+
+  // 名前は大文字小文字を区別しない。なければ空
+  std::string_view header(std::string_view name) const {
+    for (size_t i = 0; i < header_count; ++i) {
+      if (iequals(headers[i].name, name)) {
+        return headers[i].value;
+      }
+    }
+    return {};
+  }
+
+  // クエリ文字列の値（?meta=1 など）。なければ空
+  std::string_view query_param(std::string_view name) const {
+    std::string_view rest = query;
+    while (!rest.empty()) {
+      const size_t amp = rest.find('&');
+      const std::string_view pair = rest.substr(0, amp);
+      const size_t eq = pair.find('=');
+      if (pair.substr(0, eq) == name) {
+        return eq == std::string_view::npos ? std::string_view() : pair.substr(eq + 1);
+      }
+      if (amp == std::string_view::npos) {
+        break;
+      }
+      rest.remove_prefix(amp + 1);
+    }
+    return {};
+  }
+};
+
+// HTTP/1.1リクエストのインクリメンタルパーサ。
+// 受信バッファの先頭に1リクエスト分が揃うまではIncompleteを返し、
+// ヘッダ終端（空行）の探索は前回の続きから行う。
+// 本文はContent-Lengthのみ対応（chunkedは使わないので拒否する）。
+class HttpRequestParser {
+ public:
+  static constexpr size_t kMaxHeaderBytes = 8 * 1024;
+  static constexpr size_t kMaxBodyBytes = 64 * 1024;
+
+  enum class Status { Incomplete, Complete, Invalid, TooLarge };
+
+  // Completeならrequest.lengthバイトを消費してreset()すること
+  Status parse(std::string_view data, HttpRequest &request) {
+    if (header_end_ == std::string_view::npos) {
+      const size_t from = scanned_ >= 3 ? scanned_ - 3 : 0;
+      const size_t end = data.find("\r\n\r\n", from);
+      if (end == std::string_view::npos) {
+        scanned_ = data.size();
+        return data.size() > kMaxHeaderBytes ? Status::TooLarge : Status::Incomplete;
+      }
+      if (end > kMaxHeaderBytes) {
+        return Status::TooLarge;
+      }
+      header_end_ = end;
+    }
+    const Status status = parse_head(data.substr(0, header_end_ + 2), request);
+    if (status != Status::Complete) {
+      return status;
+    }
+    const size_t total = header_end_ + 4 + content_length_;
+    if (data.size() < total) {
+      return Status::Incomplete;  // 本文の残りを待つ
+    }
+    request.body = data.substr(header_end_ + 4, content_length_);
+    request.length = total;
+    return Status::Complete;
+  }
+
+  void reset() {
+    scanned_ = 0;
+    header_end_ = std::string_view::npos;
+    content_length_ = 0;
+  }
+
+ private:
+  // リクエスト行とヘッダ（最後の行の\r\nまで）
+  Status parse_head(std::string_view head, HttpRequest &request) {
+    size_t eol = head.find("\r\n");
+    std::string_view line = head.substr(0, eol);
+    const size_t sp1 = line.find(' ');
+    const size_t sp2 = sp1 == std::string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+    if (sp1 == 0 || sp2 == std::string_view::npos) {
+      return Status::Invalid;
+    }
+    request.method = line.substr(0, sp1);
+    request.target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    const std::string_view version = line.substr(sp2 + 1);
+    if (request.target.empty() || request.target[0] != '/' ||
+        (version != "HTTP/1.1" && version != "HTTP/1.0")) {
+      return Status::Invalid;
+    }
+    const size_t question = request.target.find('?');
+    request.path = request.target.substr(0, question);
+    request.query = question == std::string_view::npos
+                        ? std::string_view()
+                        : request.target.substr(question + 1);
+
+    request.header_count = 0;
+    bool has_content_length = false;
+    content_length_ = 0;
+    size_t pos = eol + 2;
+    while (pos < head.size()) {
+      eol = head.find("\r\n", pos);
+      line = head.substr(pos, eol - pos);
+      pos = eol + 2;
+      const size_t colon = line.find(':');
+      if (colon == 0 || colon == std::string_view::npos || line[0] == ' ' || line[0] == '\t') {
+        return Status::Invalid;  // 行継続（obs-fold）も拒否
+      }
+      if (request.header_count == HttpRequest::kMaxHeaders) {
+        return Status::TooLarge;
+      }
+      std::string_view value = line.substr(colon + 1);
+      while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+        value.remove_prefix(1);
+      }
+      while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+        value.remove_suffix(1);
+      }
+      const std::string_view name = line.substr(0, colon);
+      request.headers[request.header_count++] = {name, value};
+
+      if (iequals(name, "Content-Length")) {
+        if (has_content_length || value.empty() ||
+            value.find_first_not_of("0123456789") != std::string_view::npos) {
+          return Status::Invalid;
+        }
+        if (value.size() > 9) {
+          return Status::TooLarge;
+        }
+        has_content_length = true;
+        for (char c : value) {
+          content_length_ = content_length_ * 10 + static_cast<size_t>(c - '0');
+        }
+        if (content_length_ > kMaxBodyBytes) {
+          return Status::TooLarge;
+        }
+      } else if (iequals(name, "Transfer-Encoding")) {
+        return Status::Invalid;
+      }
+    }
+
+    // HTTP/1.1は Connection: close がなければ、HTTP/1.0は keep-alive があれば接続を使い回す
+    const std::string_view connection = request.header("Connection");
+    auto contains = [&connection](std::string_view token) {
+      for (size_t i = 0; i + token.size() <= connection.size(); ++i) {
+        if (iequals(connection.substr(i, token.size()), token)) {
+          return true;
+        }
+      }
+      return false;
+    };
+    request.keep_alive = version == "HTTP/1.0" ? contains("keep-alive") : !contains("close");
+    request.body = {};
+    request.length = 0;
+    return Status::Complete;
+  }
+
+  size_t scanned_ = 0;  // ヘッダ終端を探し終えた位置
+  size_t header_end_ = std::string_view::npos;
+  size_t content_length_ = 0;
+};
+
+// HTTPサーバ。1本のepollスレッドがacceptと受信を行い、リクエストが揃ったら
+// 固定数のワーカースレッドに渡す。接続はkeep-aliveで使い回し、
+// idle_timeout_sec 何も来なければ閉じる。待ち行列が一杯なら503を返す。
+class HttpServer {
+ public:
+  enum class Result {
+    KeepAlive,  // 応答済み。次のリクエストを待つ
+    Close,      // 応答済み。接続を閉じる
+    Detached,   // fdの所有権をハンドラに渡した（/stream、/api/events、クリップ）
+    Wait,       // まだ応答しない。notify_waiters()か待ち時間切れで同じリクエストを再処理する
+  };
+  using Handler = std::function<Result(int fd, const HttpRequest &request)>;
+
+  struct Config {
+    int workers = 4;
+    size_t queue_capacity = 64;
+    int idle_timeout_sec = 15;
+    int long_poll_sec = 25;  // Waitで保留する最長時間（過ぎたらwait_expiredを立てて再処理）
+  };
+
+  explicit HttpServer(Config config) : config_(config) {}
+
+  ~HttpServer() { stop(); }
+
+  bool start(int server_fd, Handler handler) {
+    handler_ = std::move(handler);
+    server_fd_ = server_fd;
+    const int flags = ::fcntl(server_fd_, F_GETFL, 0);
+    ::fcntl(server_fd_, F_SETFL, flags | O_NONBLOCK);
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+      std::cerr << "[http] epoll/eventfd failed: " << std::strerror(errno) << std::endl;
+      if (epoll_fd_ >= 0) {
+        ::close(epoll_fd_);
+      }
+      if (wake_fd_ >= 0) {
+        ::close(wake_fd_);
+      }
+      return false;
+    }
+    epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = server_fd_;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, server_fd_, &ev);
+    ev.data.fd = wake_fd_;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+    running_ = true;
+    reactor_ = std::thread(&HttpServer::reactor_loop, this);
+    for (int i = 0; i < std::max(1, config_.workers); ++i) {
+      workers_.emplace_back(&HttpServer::worker_loop, this);
+    }
+    return true;
+  }
+
+  void stop() {
+    if (!running_.exchange(false)) {
+      return;
+    }
+    const uint64_t one = 1;
+    if (::write(wake_fd_, &one, sizeof(one)) < 0) {
+      // 起こせなくてもタイムアウトで抜ける
+    }
+    queue_cv_.notify_all();
+    if (reactor_.joinable()) {
+      reactor_.join();
+    }
+    for (auto &worker : workers_) {
+      worker.join();
+    }
+    workers_.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &entry : connections_) {
+      ::close(entry.first);
+    }
+    connections_.clear();
+    queue_.clear();
+    waiting_.clear();
+    ::close(epoll_fd_);
+    ::close(wake_fd_);
+  }
+
+  // プールのサイズ調整用。開いているオブジェクトに統計のキーを書き足す
+  void write_stats(JsonWriter &json) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const uint64_t served = stats_.requests;
+    json.key("workers").value(static_cast<uint64_t>(workers_.size()))
+        .key("connections").value(static_cast<uint64_t>(connections_.size()))
+        .key("queue_depth").value(static_cast<uint64_t>(queue_.size()))
+        .key("queue_depth_max").value(static_cast<uint64_t>(stats_.queue_depth_max))
+        .key("queue_capacity").value(static_cast<uint64_t>(config_.queue_capacity))
+        .key("requests").value(served)
+        .key("rejected").value(stats_.rejected)
+        .key("idle_closed").value(stats_.idle_closed)
+        .key("long_polls").value(static_cast<uint64_t>(waiting_.size()))
+        .key("queue_wait_us_avg").value(served ? stats_.queue_wait_us_total / served : 0)
+        .key("queue_wait_us_max").value(stats_.queue_wait_us_max)
+        .key("service_us_avg").value(served ? stats_.service_us_total / served : 0)
+        .key("service_us_max").value(stats_.service_us_max);
+  }
+
+  // 状態が変わったので、Waitで保留中のリクエストを再処理させる（軽いので他のmutex内から呼んでよい）
+  void notify_waiters() {
+    wake_seq_.fetch_add(1);
+    if (!running_.load()) {
+      return;
+    }
+    const uint64_t one = 1;
+    if (::write(wake_fd_, &one, sizeof(one)) < 0) {
+      // カウンタが溢れるほど溜まっていれば既に起きる
+    }
+  }
+
+ private:
+  static constexpr int kMaxEvents = 64;
+  static constexpr size_t kMaxConnections = 256;
+  static constexpr size_t kMaxBufferedBytes = 128 * 1024;
+
+  using Clock = std::chrono::steady_clock;
+
+  struct Connection {
+    uint64_t id = 0;  // fd番号は再利用されるので接続ごとに振る
+    std::string buffer;  // 受信済みで未処理のバイト列
+    HttpRequestParser parser;  // bufferの先頭のリクエストを解析中
+    Clock::time_point last_active;
+    bool busy = false;  // ワーカーが処理中（epollから外している）
+  };
+
+  struct Job {
+    int fd;
+    uint64_t connection_id;
+    std::string request;
+    Clock::time_point queued_at;
+    Clock::time_point wait_deadline {};  // 最初にWaitを返したとき決める
+    bool wait_expired = false;
+  };
+
+  struct Stats {
+    uint64_t requests = 0;
+    uint64_t rejected = 0;
+    uint64_t idle_closed = 0;
+    size_t queue_depth_max = 0;
+    uint64_t queue_wait_us_total = 0;
+    uint64_t queue_wait_us_max = 0;
+    uint64_t service_us_total = 0;
+    uint64_t service_us_max = 0;
+  };
+
+  enum class Take { Ready, Waiting, Failed };
+
+  // バッファ先頭のリクエストが揃っていればrequestへ切り出す。
+  // 不正なリクエストにはエラーを返してFailed（呼び出し側で閉じる）
+  static Take take_request(int fd, Connection &conn, std::string &request) {
+    HttpRequest parsed;
+    const char *status = nullptr;
+    switch (conn.parser.parse(conn.buffer, parsed)) {
+      case HttpRequestParser::Status::Incomplete:
+        return Take::Waiting;
+      case HttpRequestParser::Status::Complete:
+        request.assign(conn.buffer, 0, parsed.length);
+        conn.buffer.erase(0, parsed.length);
+        conn.parser.reset();
+        return Take::Ready;
+      case HttpRequestParser::Status::Invalid:
+        status = "400 Bad Request";
+        break;
+      case HttpRequestParser::Status::TooLarge:
+        status = "413 Payload Too Large";
+        break;
+    }
+    char response[128];
+    const int len = std::snprintf(response, sizeof(response),
+                                  "HTTP/1.1 %s\r\n"
+                                  "Content-Length: 0\r\n"
+                                  "Connection: close\r\n\r\n",
+                                  status);
+    ::send(fd, response, static_cast<size_t>(len), MSG_DONTWAIT | MSG_NOSIGNAL);
+    return Take::Failed;
+  }
+
+  void watch(int fd) {
+    epoll_event ev {};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.fd = fd;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  // mutex_を保持して呼ぶ
+  void close_locked(int fd) {
+    connections_.erase(fd);
+    ::close(fd);
+  }
+
+  void reactor_loop() {
+    epoll_event events[kMaxEvents];
+    while (running_.load()) {
+      const int n = ::epoll_wait(epoll_fd_, events, kMaxEvents, 1000);
+      if (n < 0 && errno != EINTR) {
+        std::cerr << "[http] epoll_wait failed: " << std::strerror(errno) << std::endl;
+        break;
+      }
+      bool woken = false;
+      for (int i = 0; i < n; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == wake_fd_) {
+          uint64_t count = 0;
+          if (::read(wake_fd_, &count, sizeof(count)) < 0) {
+            // 既に読まれている
+          }
+          woken = true;
+          continue;
+        }
+        if (fd == server_fd_) {
+          accept_all();
+          continue;
+        }
+        on_readable(fd);
+      }
+      resume_waiting(woken);
+      close_idle();
+    }
+  }
+
+  // 保留中のリクエストを、通知があれば全部、なければ待ち時間切れのものだけキューへ戻す
+  void resume_waiting(bool woken) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (waiting_.empty()) {
+      return;
+    }
+    const auto now = Clock::now();
+    const size_t queued = queue_.size();
+    auto keep = waiting_.begin();
+    for (auto it = waiting_.begin(); it != waiting_.end(); ++it) {
+      it->wait_expired = now >= it->wait_deadline;
+      if (woken || it->wait_expired) {
+        it->queued_at = now;
+        queue_.push_back(std::move(*it));
+      } else {
+        if (keep != it) {
+          *keep = std::move(*it);
+        }
+        ++keep;
+      }
+    }
+    waiting_.erase(keep, waiting_.end());
+    const bool resumed = queue_.size() > queued;
+    lock.unlock();
+    if (resumed) {
+      queue_cv_.notify_all();
+    }
+  }
+
+  void accept_all() {
+    while (true) {
+      const int fd = ::accept4(server_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          std::cerr << "[http] accept() failed: " << std::strerror(errno) << std::endl;
+        }
+        return;
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (connections_.size() >= kMaxConnections) {
+        ::close(fd);
+        continue;
+      }
+      // ワーカーは同期送信するので、受け取らないクライアントで止まり続けないようにする
+      timeval timeout {};
+      timeout.tv_sec = 10;
+      ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+      Connection &conn = connections_[fd];
+      conn = Connection();
+      conn.id = next_connection_id_++;
+      conn.last_active = Clock::now();
+      watch(fd);
+    }
+  }
+
+  void on_readable(int fd) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = connections_.find(fd);
+    if (it == connections_.end() || it->second.busy) {
+      return;
+    }
+    Connection &conn = it->second;
+    char chunk[4096];
+    while (true) {
+      const ssize_t n = ::recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+      if (n > 0) {
+        conn.buffer.append(chunk, static_cast<size_t>(n));
+        if (conn.buffer.size() > kMaxBufferedBytes) {
+          close_locked(fd);
+          return;
+        }
+        continue;
+      }
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        close_locked(fd);  // 切断（keep-alive中のクローズを含む）
+        return;
+      }
+      break;
+    }
+    conn.last_active = Clock::now();
+
+    std::string request;
+    const Take take = take_request(fd, conn, request);
+    if (take == Take::Failed) {
+      close_locked(fd);
+      return;
+    }
+    if (take == Take::Waiting) {
+      return;  // 続きを待つ
+    }
+    if (queue_.size() >= config_.queue_capacity) {
+      stats_.rejected++;
+      static const char kBusy[] =
+          "HTTP/1.1 503 Service Unavailable\r\n"
+          "Content-Length: 0\r\n"
+          "Retry-After: 1\r\n"
+          "Connection: close\r\n\r\n";
+      ::send(fd, kBusy, sizeof(kBusy) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+      close_locked(fd);
+      return;
+    }
+    // 処理中はepollから外す（応答後にwatch()で戻す）
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    conn.busy = true;
+    queue_.push_back({fd, conn.id, std::move(request), Clock::now()});
+    stats_.queue_depth_max = std::max(stats_.queue_depth_max, queue_.size());
+    lock.unlock();
+    queue_cv_.notify_one();
+  }
+
+  void close_idle() {
+    const auto deadline = Clock::now() - std::chrono::seconds(config_.idle_timeout_sec);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = connections_.begin(); it != connections_.end();) {
+      if (!it->second.busy && it->second.last_active < deadline) {
+        ::close(it->first);
+        it = connections_.erase(it);
+        stats_.idle_closed++;
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  void worker_loop() {
+    while (true) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        queue_cv_.wait(lock, [this] { return !queue_.empty() || !running_.load(); });
+        if (!running_.load()) {
+          return;
+        }
+        job = std::move(queue_.front());
+        queue_.pop_front();
+      }
+
+      // パイプライン化されたリクエストが既に揃っていれば続けて処理する
+      HttpRequestParser parser;
+      HttpRequest request;
+      while (true) {
+        const auto started = Clock::now();
+        const uint64_t wake_seq = wake_seq_.load();
+        parser.reset();
+        parser.parse(job.request, request);  // 揃っていることは確認済み
+        request.wait_expired = job.wait_expired;
+        const Result result = handler_(job.fd, request);
+        const auto finished = Clock::now();
+        const auto wait_us = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(started - job.queued_at).count());
+        const auto service_us = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(finished - started).count());
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.requests++;
+        stats_.queue_wait_us_total += wait_us;
+        stats_.queue_wait_us_max = std::max(stats_.queue_wait_us_max, wait_us);
+        stats_.service_us_total += service_us;
+        stats_.service_us_max = std::max(stats_.service_us_max, service_us);
+
+        auto it = connections_.find(job.fd);
+        if (result == Result::Detached) {
+          // 渡した先で既に閉じられ、同じfd番号で次の接続が来ている場合がある
+          if (it != connections_.end() && it->second.id == job.connection_id) {
+            connections_.erase(it);
+          }
+          break;
+        }
+        if (result == Result::Close || it == connections_.end() || !running_.load() ||
+            (result == Result::Wait && job.wait_expired)) {
+          close_locked(job.fd);
+          break;
+        }
+        if (result == Result::Wait) {
+          // 接続はbusyのまま（epollから外したまま）保留する
+          if (job.wait_deadline == Clock::time_point()) {
+            job.wait_deadline = finished + std::chrono::seconds(config_.long_poll_sec);
+          }
+          job.queued_at = finished;
+          if (wake_seq_.load() != wake_seq) {
+            // ハンドラの判定中に通知が来ていたら、取りこぼさないようすぐ再処理する
+            queue_.push_back(std::move(job));
+            queue_cv_.notify_one();
+          } else {
+            waiting_.push_back(std::move(job));
+          }
+          break;
+        }
+        Connection &conn = it->second;
+        conn.last_active = finished;
+        const Take take = take_request(job.fd, conn, job.request);
+        if (take == Take::Failed) {
+          close_locked(job.fd);
+          break;
+        }
+        if (take == Take::Waiting) {
+          conn.busy = false;
+          watch(job.fd);
+          break;
+        }
+        job.queued_at = finished;
       }
     }
-    
-    return false;
-  }
-
-  // 固定IDを指定して登録解除
-  bool unregister_person(int fixed_id) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    if (fixed_id < 0 || fixed_id >= MAX_REGISTERED_PERSONS) {
-      return false;
-    }
-    
-    if (registered_persons_[fixed_id].active) {
-      registered_persons_[fixed_id].active = false;
-      std::cout << "[api] Unregistered Fixed ID " << fixed_id << std::endl;
-      std::cout.flush();
-      return true;
-    }
-    
-    return false;
   }
 
-  // 全員登録解除
-  void clear_all() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    for (auto &person : registered_persons_) {
-      person.active = false;
-    }
-    std::cout << "[api] Cleared all registrations" << std::endl;
-    std::cout.flush();
-  }
+  Config config_;
+  Handler handler_;
+  int server_fd_ = -1;
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+  std::atomic<bool> running_{false};
+  std::thread reactor_;
+  std::vector<std::thread> workers_;
 
- private:
   mutable std::mutex mutex_;
-  std::vector<Detection> detections_;
-  std::array<RegisteredPerson, MAX_REGISTERED_PERSONS> registered_persons_;
-  std::vector<Alert> alerts_;
+  std::condition_variable queue_cv_;
+  std::deque<Job> queue_;
+  std::vector<Job> waiting_;  // Waitを返して保留中（長ポーリング）
+  std::atomic<uint64_t> wake_seq_{0};  // notify_waiters()の回数
+  std::unordered_map<int, Connection> connections_;
+  uint64_t next_connection_id_ = 1;
+  Stats stats_;
 };
 
-std::string detections_to_json(const std::vector<DetectionStore::DetectionWithFixedId> &detections) {
-  std::ostringstream oss;
-  oss << "{\"detections\":[";
-  for (size_t i = 0; i < detections.size(); ++i) {
-    if (i > 0) oss << ",";
-    const auto &d = detections[i].detection;
-    const int fixed_id = detections[i].fixed_id;
-    oss << "{"
-        << "\"nvtracker_id\":" << d.tracking_id << ","
-        << "\"fixed_id\":" << fixed_id << ","
-        << "\"registered\":" << (fixed_id >= 0 ? "true" : "false") << ","
-        << "\"class_id\":" << d.class_id << ","
-        << "\"confidence\":" << d.confidence << ","
-        << "\"bbox\":{\"left\":" << d.left << ",\"top\":" << d.top
-        << ",\"width\":" << d.width << ",\"height\":" << d.height << "}"
-        << "}";
-  }
-  oss << "]}";
-  return oss.str();
+// /api/* のハンドラに渡すもの
+struct ApiContext {
+  int fd;
+  const HttpRequest &request;
+  DetectionStore &detection_store;
+  DetectionJsonCache &detection_json;
+  DetectionBinaryCache &detection_binary;
+  const DetectionRing &detection_ring;
+  const ClipRecorder &clip_recorder;
+  ClipSender &clip_sender;
+  const HttpServer &http_server;
+};
+
+struct ApiResponse {
+  const char *status = "200 OK";
+  const char *content_type = "application/json";
+  std::string body;
+  std::shared_ptr<const std::string> shared_body;  // 設定されていればbodyの代わりに送る
+  std::string etag;  // 設定されていれば付ける。If-None-Matchが一致すれば本文なしの304
+  const char *vary = nullptr;  // 設定されていればVaryヘッダを付ける（本文がリクエストヘッダで変わるとき）
+  bool detached = false;  // fdをClipSenderに渡した（以降の送信と切断は渡した先が行う）
+  bool wait = false;  // 長ポーリング: 変化があるまで応答を保留する
+};
+
+// APIのETagに入れるプロセスごとの値。版番号は再起動で0からやり直すので、
+// これがないと再起動前にキャッシュした本文が同じ版番号の新しい本文として304で返る
+const std::string &api_etag_epoch() {
+  static const std::string epoch = [] {
+    std::random_device random;
+    char text[16];
+    std::snprintf(text, sizeof(text), "%08x", static_cast<unsigned>(random()));
+    return std::string(text);
+  }();
+  return epoch;
 }
 
-std::string alerts_to_json(const std::vector<Alert> &alerts) {
-  std::ostringstream oss;
-  oss << "{\"alerts\":[";
-  for (size_t i = 0; i < alerts.size(); ++i) {
-    if (i > 0) oss << ",";
-    const auto &a = alerts[i];
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-        a.timestamp.time_since_epoch()).count();
-    oss << "{"
-        << "\"index\":" << i << ","
-        << "\"fixed_id\":" << a.fixed_id << ","
-        << "\"type\":" << static_cast<int>(a.type) << ","
-        << "\"message\":\"" << a.message << "\","
-        << "\"timestamp\":" << ms << ","
-        << "\"acknowledged\":" << (a.acknowledged ? "true" : "false")
-        << "}";
-  }
-  oss << "]}";
-  return oss.str();
+ApiResponse api_error(const char *status, const char *message) {
+  ApiResponse response;
+  response.status = status;
+  response.body = std::string("{\"error\":\"") + message + "\"}";
+  return response;
 }
 
-bool send_all(int fd, const void *data, size_t len) {
-  const auto *ptr = static_cast<const uint8_t *>(data);
-  size_t remaining = len;
-  while (remaining > 0) {
-    ssize_t written = ::send(fd, ptr, remaining, MSG_NOSIGNAL);
-    if (written < 0) {
-      if (errno == EINTR) {
-        continue;
-      }
-      return false;
-    }
-    ptr += written;
-    remaining -= static_cast<size_t>(written);
+// ?since=<版> の共通処理。クライアントの持っている版から変わっていなければtrueを返し、
+// responseを304（&wait=1 なら変わるまで保留）にする
+bool api_unchanged_since(const ApiContext &ctx, uint64_t current, uint64_t since,
+                         ApiResponse &response) {
+  if (ctx.request.query_param("since").empty() || current != since) {
+    return false;
+  }
+  if (ctx.request.query_param("wait") == "1" && !ctx.request.wait_expired) {
+    response.wait = true;
+  } else {
+    response.status = "304 Not Modified";
   }
   return true;
 }
 
-void serve_mjpeg_client(int client_fd, FrameStore &store) {
-  static const char kHeader[] =
-      "HTTP/1.1 200 OK\r\n"
-      "Cache-Control: no-cache\r\n"
-      "Pragma: no-cache\r\n"
-      "Connection: close\r\n"
-      "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n";
-
-  if (!send_all(client_fd, kHeader, sizeof(kHeader) - 1)) {
-    ::close(client_fd);
-    return;
+// Accept: application/x-edge-detections ならバイナリ。?base=<版> で差分になる。
+// ?since=<版> はその版から変わっていなければ304（バイナリではbase省略時の基準にもなる）
+ApiResponse api_get_detections(ApiContext &ctx) {
+  uint64_t since = 0;
+  if (!ctx.request.query_param("since").empty() &&
+      !parse_decimal(ctx.request.query_param("since"), since)) {
+    return api_error("400 Bad Request", "Invalid since");
   }
-
-  uint64_t cursor = 0;
-  std::vector<uint8_t> frame;
-  while (g_running.load()) {
-    if (!store.wait_for_frame(cursor, frame)) {
-      continue;
+  // キャッシュは後から版を読むので、本文の版はversion以上（ETagが本文より新しくはならない）
+  const uint64_t version = ctx.detection_store.snapshot()->version;
+  ApiResponse response;
+  response.vary = "Accept";  // AcceptでJSONとバイナリが切り替わる（キャッシュが混同しないように）
+  if (ctx.request.header("Accept").find(DetectionBinaryCache::kContentType) !=
+      std::string_view::npos) {
+    uint64_t base = since <= UINT32_MAX ? since : 0;
+    if (!ctx.request.query_param("base").empty() &&
+        (!parse_decimal(ctx.request.query_param("base"), base) || base > UINT32_MAX)) {
+      return api_error("400 Bad Request", "Invalid base");
     }
-    std::ostringstream oss;
-    oss << "--frame\r\n"
-        << "Content-Type: image/jpeg\r\n"
-        << "Content-Length: " << frame.size() << "\r\n\r\n";
-    const std::string prefix = oss.str();
-    if (!send_all(client_fd, prefix.data(), prefix.size())) {
-      break;
-    }
-    if (!frame.empty() && !send_all(client_fd, frame.data(), frame.size())) {
-      break;
-    }
-    static const char kSuffix[] = "\r\n";
-    if (!send_all(client_fd, kSuffix, sizeof(kSuffix) - 1)) {
-      break;
+    response.etag = "\"b" + api_etag_epoch() + "." + std::to_string(version) + "-" +
+                    std::to_string(base) + "\"";
+    if (api_unchanged_since(ctx, version, since, response)) {
+      return response;
     }
+    response.content_type = DetectionBinaryCache::kContentType;
+    response.shared_body = ctx.detection_binary.get(static_cast<uint32_t>(base)).data;
+    return response;
   }
+  response.etag = "\"d" + api_etag_epoch() + "." + std::to_string(version) + "\"";
+  if (api_unchanged_since(ctx, version, since, response)) {
+    return response;
+  }
+  response.shared_body = ctx.detection_json.get();
+  return response;
+}
 
-  ::close(client_fd);
-  // std::cout << "[http] MJPEG client disconnected" << std::endl;
+// ?since=<版> ならその版より後に追加・確認されたアラートだけ（alerts_to_json参照）
+ApiResponse api_get_alerts(ApiContext &ctx) {
+  uint64_t since = 0;
+  if (!ctx.request.query_param("since").empty() &&
+      !parse_decimal(ctx.request.query_param("since"), since)) {
+    return api_error("400 Bad Request", "Invalid since");
+  }
+  const DetectionStore::SnapshotPtr snapshot = ctx.detection_store.snapshot();
+  ApiResponse response;
+  response.etag = "\"a" + api_etag_epoch() + "." + std::to_string(snapshot->alerts_version) +
+                  "-" + std::to_string(since) + "\"";
+  if (api_unchanged_since(ctx, snapshot->alerts_version, since, response)) {
+    return response;
+  }
+  response.body = alerts_to_json(*snapshot, since);
+  return response;
 }
 
-std::string read_request_body(int client_fd, size_t content_length) {
-  if (content_length == 0 || content_length > 4096) {
-    return "";
+// アラート前後の映像クリップ（MJPEG-AVI）: /api/alerts/{id}/clip
+ApiResponse api_get_alert_clip(ApiContext &ctx) {
+  uint64_t alert_id = 0;
+  if (!parse_clip_path(ctx.request.path, alert_id)) {
+    return api_error("404 Not Found", "Not found");
   }
-  std::vector<char> buffer(content_length);
-  size_t total_read = 0;
-  while (total_read < content_length) {
-    ssize_t n = ::recv(client_fd, buffer.data() + total_read, 
-                       content_length - total_read, 0);
-    if (n <= 0) break;
-    total_read += n;
+  ApiResponse response;
+  std::string clip_path;
+  switch (ctx.clip_recorder.state(alert_id, clip_path)) {
+    case ClipRecorder::ClipState::Ready:
+      // 送信はClipSenderのepollスレッドが行い、このワーカーはすぐ次のリクエストへ戻る
+      switch (ctx.clip_sender.send(ctx.fd, clip_path, "video/x-msvideo")) {
+        case ClipSender::Start::Started:
+          response.detached = true;
+          return response;
+        case ClipSender::Start::Busy:
+          return api_error("503 Service Unavailable", "Too many clip downloads");
+        case ClipSender::Start::NotFound:
+          break;
+      }
+      return api_error("404 Not Found", "Clip unavailable");
+    case ClipRecorder::ClipState::Recording:
+      response.status = "202 Accepted";
+      response.body = "{\"status\":\"recording\",\"id\":" + std::to_string(alert_id) + "}";
+      return response;
+    case ClipRecorder::ClipState::Failed:
+      response.status = "500 Internal Server Error";
+      response.body = "{\"status\":\"failed\",\"id\":" + std::to_string(alert_id) + "}";
+      return response;
+    case ClipRecorder::ClipState::Unknown:
+      break;
   }
-  return std::string(buffer.data(), total_read);
+  return api_error("404 Not Found", "Not found");
 }
 
-uint64_t parse_nvtracker_id_from_json(const std::string &json) {
-  // Simple JSON parsing: {"nvtracker_id":123}
-  size_t pos = json.find("\"nvtracker_id\"");
-  if (pos == std::string::npos) return 0;
-  pos = json.find(":", pos);
-  if (pos == std::string::npos) return 0;
-  pos++;
-  while (pos < json.size() && std::isspace(json[pos])) pos++;
-  uint64_t id = 0;
-  while (pos < json.size() && std::isdigit(json[pos])) {
-    id = id * 10 + (json[pos] - '0');
-    pos++;
+ApiResponse api_get_config(ApiContext &ctx) {
+  ApiResponse response;
+  const bool auto_reg = ctx.detection_store.get_auto_register();
+  response.body = "{\"auto_register\":" + std::string(auto_reg ? "true" : "false") + "}";
+  return response;
+}
+
+// HTTPワーカープールの統計
+ApiResponse api_get_stats(ApiContext &ctx) {
+  ApiResponse response;
+  // HTTPワーカーの統計に解析リングの統計を加える
+  JsonWriter json;
+  json.begin_object();
+  ctx.http_server.write_stats(json);
+  json.key("analytics").begin_object();
+  ctx.detection_ring.write_stats(json);
+  json.end_object().end_object();
+  response.body = json.str();
+  return response;
+}
+
+// 手動登録
+ApiResponse api_post_register(ApiContext &ctx) {
+  int64_t nvtracker_id = 0;
+  if (!parse_json_int(ctx.request.body, "nvtracker_id", nvtracker_id) || nvtracker_id < 0) {
+    return api_error("400 Bad Request", "nvtracker_id required");
   }
-  return id;
+  const bool success =
+      ctx.detection_store.register_by_nvtracker_id(static_cast<uint64_t>(nvtracker_id));
+  ApiResponse response;
+  response.body = std::string("{\"status\":\"") + (success ? "registered" : "failed") +
+                  "\",\"nvtracker_id\":" + std::to_string(nvtracker_id) + "}";
+  return response;
 }
 
-int parse_fixed_id_from_json(const std::string &json) {
-  // Simple JSON parsing: {"fixed_id":0}
-  size_t pos = json.find("\"fixed_id\"");
-  if (pos == std::string::npos) return -1;
-  pos = json.find(":", pos);
-  if (pos == std::string::npos) return -1;
-  pos++;
-  while (pos < json.size() && std::isspace(json[pos])) pos++;
-  int id = 0;
-  bool negative = false;
-  if (pos < json.size() && json[pos] == '-') {
-    negative = true;
-    pos++;
+// 自動登録モード: nvtracker IDを指定して登録解除
+ApiResponse api_post_unregister(ApiContext &ctx) {
+  int64_t nvtracker_id = 0;
+  if (!parse_json_int(ctx.request.body, "nvtracker_id", nvtracker_id) || nvtracker_id < 0) {
+    return api_error("400 Bad Request", "nvtracker_id required");
   }
-  while (pos < json.size() && std::isdigit(json[pos])) {
-    id = id * 10 + (json[pos] - '0');
-    pos++;
+  const bool success =
+      ctx.detection_store.unregister_by_nvtracker_id(static_cast<uint64_t>(nvtracker_id));
+  ApiResponse response;
+  response.body = std::string("{\"status\":\"") + (success ? "unregistered" : "failed") +
+                  "\",\"nvtracker_id\":" + std::to_string(nvtracker_id) + "}";
+  return response;
+}
+
+ApiResponse api_post_clear(ApiContext &ctx) {
+  ctx.detection_store.clear_all();
+  ApiResponse response;
+  response.body = "{\"status\":\"cleared\"}";
+  return response;
+}
+
+// アラート確認
+// {"id": N} で指定する。旧形式の {"index": N} は現在の一覧の位置として解決する
+ApiResponse api_post_acknowledge_alert(ApiContext &ctx) {
+  int64_t id = 0;
+  if (!parse_json_int(ctx.request.body, "id", id)) {
+    int64_t index = 0;
+    if (!parse_json_int(ctx.request.body, "index", index) || index < 0) {
+      return api_error("400 Bad Request", "id required");
+    }
+    const auto alerts = ctx.detection_store.get_alerts();
+    if (static_cast<uint64_t>(index) >= alerts->size()) {
+      return api_error("404 Not Found", "Alert not found");
+    }
+    id = static_cast<int64_t>((*alerts)[index].id);
+  }
+  if (id <= 0 || !ctx.detection_store.acknowledge_alert(static_cast<uint64_t>(id))) {
+    return api_error("404 Not Found", "Alert not found");
   }
-  return negative ? -id : id;
+  ApiResponse response;
+  response.body = "{\"status\":\"acknowledged\",\"id\":" + std::to_string(id) + "}";
+  return response;
 }
 
-void serve_api_client(int client_fd, const std::string &request,
-                      DetectionStore &detection_store) {
-  std::string response_body;
-  std::string status = "200 OK";
-  
-  // Parse request method and path
-  size_t method_end = request.find(' ');
-  if (method_end == std::string::npos) {
-    response_body = "{\"error\":\"Bad request\"}";
-    status = "400 Bad Request";
-  } else {
-    std::string method = request.substr(0, method_end);
-    size_t path_start = method_end + 1;
-    size_t path_end = request.find(' ', path_start);
-    std::string path = request.substr(path_start, path_end - path_start);
-    
-    if (method == "GET" && path == "/api/detections") {
-      auto detections = detection_store.get_with_fixed_ids();
-      response_body = detections_to_json(detections);
-    } else if (method == "GET" && path == "/api/alerts") {
-      auto alerts = detection_store.get_alerts();
-      response_body = alerts_to_json(alerts);
-    } else if (method == "POST" && path == "/api/unregister") {
-      // 自動登録モード: nvtracker IDを指定して登録解除
-      size_t cl_pos = request.find("Content-Length:");
-      size_t content_length = 0;
-      if (cl_pos != std::string::npos) {
-        content_length = std::atoi(request.c_str() + cl_pos + 15);
-      }
-      
-      size_t body_start = request.find("\r\n\r\n");
-      std::string body;
-      if (body_start != std::string::npos) {
-        body = request.substr(body_start + 4);
-        if (body.size() < content_length) {
-          body += read_request_body(client_fd, content_length - body.size());
-        }
-      }
-      
-      uint64_t nvtracker_id = parse_nvtracker_id_from_json(body);
-      bool success = detection_store.unregister_by_nvtracker_id(nvtracker_id);
-      
-      if (success) {
-        response_body = "{\"status\":\"unregistered\",\"nvtracker_id\":" + 
-                       std::to_string(nvtracker_id) + "}";
-      } else {
-        response_body = "{\"status\":\"failed\",\"nvtracker_id\":" + 
-                       std::to_string(nvtracker_id) + "}";
-      }
-    } else if (method == "POST" && path == "/api/clear") {
-      detection_store.clear_all();
-      response_body = "{\"status\":\"cleared\"}";
-    } else if (method == "POST" && path == "/api/acknowledge_alert") {
-      // アラート確認
-      size_t cl_pos = request.find("Content-Length:");
-      size_t content_length = 0;
-      if (cl_pos != std::string::npos) {
-        content_length = std::atoi(request.c_str() + cl_pos + 15);
-      }
-      
-      size_t body_start = request.find("\r\n\r\n");
-      std::string body;
-      if (body_start != std::string::npos) {
-        body = request.substr(body_start + 4);
-        if (body.size() < content_length) {
-          body += read_request_body(client_fd, content_length - body.size());
-        }
-      }
-      
-      int index = parse_fixed_id_from_json(body.replace(body.find("\"index\""), 7, "\"fixed_id\""));
-      detection_store.acknowledge_alert(index);
-      response_body = "{\"status\":\"acknowledged\",\"index\":" + std::to_string(index) + "}";
-    } else if (method == "POST" && path == "/api/clear_alerts") {
-      detection_store.clear_alerts();
-      response_body = "{\"status\":\"alerts_cleared\"}";
-    } else if (method == "POST" && path == "/api/register") {
-      // 手動登録
-      size_t cl_pos = request.find("Content-Length:");
-      size_t content_length = 0;
-      if (cl_pos != std::string::npos) {
-        content_length = std::atoi(request.c_str() + cl_pos + 15);
-      }
-      
-      size_t body_start = request.find("\r\n\r\n");
-      std::string body;
-      if (body_start != std::string::npos) {
-        body = request.substr(body_start + 4);
-        if (body.size() < content_length) {
-          body += read_request_body(client_fd, content_length - body.size());
-        }
-      }
-      
-      uint64_t nvtracker_id = parse_nvtracker_id_from_json(body);
-      bool success = detection_store.register_by_nvtracker_id(nvtracker_id);
-      
-      if (success) {
-        response_body = "{\"status\":\"registered\",\"nvtracker_id\":" + 
-                       std::to_string(nvtracker_id) + "}";
-      } else {
-        response_body = "{\"status\":\"failed\",\"nvtracker_id\":" + 
-                       std::to_string(nvtracker_id) + "}";
-      }
-    } else if (method == "POST" && path == "/api/toggle_auto_register") {
-      // 自動登録モードの切り替え
-      bool current = detection_store.get_auto_register();
-      detection_store.set_auto_register(!current);
-      response_body = "{\"status\":\"toggled\",\"auto_register\":" + 
-                     std::string(!current ? "true" : "false") + "}";
-    } else if (method == "GET" && path == "/api/config") {
-      // 設定取得
-      bool auto_reg = detection_store.get_auto_register();
-      response_body = "{\"auto_register\":" + std::string(auto_reg ? "true" : "false") + "}";
-    } else {
-      response_body = "{\"error\":\"Not found\"}";
-      status = "404 Not Found";
+ApiResponse api_post_clear_alerts(ApiContext &ctx) {
+  ctx.detection_store.clear_alerts();
+  ApiResponse response;
+  response.body = "{\"status\":\"alerts_cleared\"}";
+  return response;
+}
+
+// 自動登録モードの切り替え
+ApiResponse api_post_toggle_auto_register(ApiContext &ctx) {
+  const bool current = ctx.detection_store.get_auto_register();
+  ctx.detection_store.set_auto_register(!current);
+  ApiResponse response;
+  response.body = "{\"status\":\"toggled\",\"auto_register\":" +
+                  std::string(!current ? "true" : "false") + "}";
+  return response;
+}
+
+struct ApiRoute {
+  std::string_view method;
+  std::string_view path;
+  bool prefix;  // pathで始まるパスすべて（パラメータ付き）
+  ApiResponse (*handler)(ApiContext &);
+};
+
+constexpr ApiRoute kApiRoutes[] = {
+    {"GET", "/api/detections", false, api_get_detections},
+    {"GET", "/api/alerts", false, api_get_alerts},
+    {"GET", "/api/alerts/", true, api_get_alert_clip},
+    {"GET", "/api/config", false, api_get_config},
+    {"GET", "/api/stats", false, api_get_stats},
+    {"POST", "/api/register", false, api_post_register},
+    {"POST", "/api/unregister", false, api_post_unregister},
+    {"POST", "/api/clear", false, api_post_clear},
+    {"POST", "/api/acknowledge_alert", false, api_post_acknowledge_alert},
+    {"POST", "/api/clear_alerts", false, api_post_clear_alerts},
+    {"POST", "/api/toggle_auto_register", false, api_post_toggle_auto_register},
+};
+
+HttpServer::Result serve_api_client(int client_fd, const HttpRequest &request,
+                      DetectionStore &detection_store,
+                      DetectionJsonCache &detection_json,
+                      DetectionBinaryCache &detection_binary,
+                      const DetectionRing &detection_ring,
+                      const ClipRecorder &clip_recorder,
+                      ClipSender &clip_sender,
+                      const HttpServer &http_server) {
+  ApiContext ctx{client_fd, request, detection_store, detection_json, detection_binary,
+                 detection_ring, clip_recorder, clip_sender, http_server};
+  ApiResponse response = api_error("404 Not Found", "Not found");
+  for (const ApiRoute &route : kApiRoutes) {
+    const bool path_matches =
+        route.prefix ? request.path.substr(0, route.path.size()) == route.path
+                     : request.path == route.path;
+    if (!path_matches) {
+      continue;
+    }
+    if (request.method == route.method) {
+      response = route.handler(ctx);
+      break;
     }
+    response = api_error("405 Method Not Allowed", "Method not allowed");
+  }
+  if (response.detached) {
+    return HttpServer::Result::Detached;
+  }
+  if (response.wait) {
+    return HttpServer::Result::Wait;
   }
 
-  std::ostringstream oss;
-  oss << "HTTP/1.1 " << status << "\r\n"
-      << "Content-Type: application/json\r\n"
-      << "Content-Length: " << response_body.size() << "\r\n"
-      << "Access-Control-Allow-Origin: *\r\n"
-      << "Connection: close\r\n\r\n"
-      << response_body;
-
-  const std::string response = oss.str();
-  send_all(client_fd, response.data(), response.size());
-  ::close(client_fd);
+  if (!response.etag.empty() &&
+      request.header("If-None-Match").find(response.etag) != std::string_view::npos) {
+    response.status = "304 Not Modified";
+  }
+  // 304は本文なし（?since=で変化なしのときも同じ）
+  static const std::string kNoBody;
+  const bool not_modified = std::strcmp(response.status, "304 Not Modified") == 0;
+  const std::string &body = not_modified ? kNoBody
+      : response.shared_body ? *response.shared_body : response.body;
+  std::string extra_headers;
+  if (!response.etag.empty()) {
+    // ブラウザが毎回If-None-Matchで確認するようにno-cache
+    extra_headers = "ETag: " + response.etag + "\r\nCache-Control: no-cache\r\n";
+  }
+  if (response.vary) {
+    extra_headers.append("Vary: ").append(response.vary).append("\r\n");
+  }
+  char header[512];
+  const int len = std::snprintf(header, sizeof(header),
+                                "HTTP/1.1 %s\r\n"
+                                "Content-Type: %s\r\n"
+                                "Content-Length: %zu\r\n"
+                                "%s"
+                                "Access-Control-Allow-Origin: *\r\n"
+                                "Connection: %s\r\n\r\n",
+                                response.status, response.content_type, body.size(),
+                                extra_headers.c_str(),
+                                request.keep_alive ? "keep-alive" : "close");
+  iovec iov[2];
+  iov[0].iov_base = header;
+  iov[0].iov_len = static_cast<size_t>(len);
+  iov[1].iov_base = const_cast<char *>(body.data());
+  iov[1].iov_len = body.size();
+  if (!send_iov(client_fd, iov, 2) || !request.keep_alive) {
+    return HttpServer::Result::Close;
+  }
+  return HttpServer::Result::KeepAlive;
 }
 
-std::string read_http_request(int client_fd) {
-  char buffer[4096];
-  ssize_t n = ::recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-  if (n <= 0) {
+std::string gzip_compress(const std::string &data) {
+  z_stream zs {};
+  // windowBits 15 + 16 でgzipヘッダ付き
+  if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
     return "";
   }
-  buffer[n] = '\0';
-  return std::string(buffer);
+  std::string out(deflateBound(&zs, data.size()), '\0');
+  zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  zs.avail_in = static_cast<uInt>(data.size());
+  zs.next_out = reinterpret_cast<Bytef *>(&out[0]);
+  zs.avail_out = static_cast<uInt>(out.size());
+  const int ret = deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return ret == Z_STREAM_END ? out : std::string();
 }
 
-bool is_api_request(const std::string &request) {
-  return request.find("GET /api/") == 0 || 
-         request.find("POST /api/") == 0;
-}
+// UIのHTMLをメモリに保持して配信する。
+// 読み込み時にgzip版とETagを作っておき、リクエストごとのSDカード読み込みをなくす。
+// 毎回stat()だけ行い、mtime/サイズが変わっていたら読み直す。
+class StaticAssets {
+ public:
+  explicit StaticAssets(std::string directory) : directory_(std::move(directory)) {}
 
-void serve_html_file(int client_fd, const std::string &filepath) {
-  std::ifstream file(filepath);
-  if (!file) {
-    const char *response = 
-        "HTTP/1.1 404 Not Found\r\n"
-        "Content-Type: text/plain\r\n"
-        "Connection: close\r\n\r\n"
-        "File not found";
-    send_all(client_fd, response, std::strlen(response));
-    ::close(client_fd);
-    return;
+  void add(const std::string &name, const std::string &filename,
+           const char *content_type) {
+    Entry entry;
+    entry.path = directory_ + "/" + filename;
+    entry.content_type = content_type;
+    std::lock_guard<std::mutex> lock(mutex_);
+    refresh(entry);
+    if (!entry.asset) {
+      std::cerr << "[ui] cannot read " << entry.path << std::endl;
+    }
+    entries_[name] = std::move(entry);
   }
-  
-  std::ostringstream content;
-  content << file.rdbuf();
-  std::string body = content.str();
-  
-  std::ostringstream response;
-  response << "HTTP/1.1 200 OK\r\n"
-           << "Content-Type: text/html; charset=utf-8\r\n"
-           << "Content-Length: " << body.size() << "\r\n"
-           << "Connection: close\r\n\r\n"
-           << body;
-  
-  std::string resp_str = response.str();
-  send_all(client_fd, resp_str.data(), resp_str.size());
-  ::close(client_fd);
-}
+
+  // 応答後も接続を使い回せるならtrue
+  bool serve(int client_fd, const std::string &name, const HttpRequest &request) {
+    std::shared_ptr<const Asset> asset;
+    const char *content_type = "text/plain";
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = entries_.find(name);
+      if (it != entries_.end()) {
+        refresh(it->second);
+        asset = it->second.asset;
+        content_type = it->second.content_type;
+      }
+    }
+    if (!asset) {
+      const char *response =
+          "HTTP/1.1 404 Not Found\r\n"
+          "Content-Type: text/plain\r\n"
+          "Content-Length: 14\r\n"
+          "Connection: close\r\n\r\n"
+          "File not found";
+      send_all(client_fd, response, std::strlen(response));
+      return false;
+    }
+
+    const bool gzip = !asset->gzip_body.empty() &&
+                      request.header("Accept-Encoding").find("gzip") !=
+                          std::string_view::npos;
+    const std::string &etag = gzip ? asset->gzip_etag : asset->etag;
+    const std::string &body = gzip ? asset->gzip_body : asset->body;
+    const bool not_modified =
+        request.header("If-None-Match").find(etag) != std::string_view::npos;
+
+    std::ostringstream oss;
+    oss << (not_modified ? "HTTP/1.1 304 Not Modified\r\n" : "HTTP/1.1 200 OK\r\n")
+        << "Content-Type: " << content_type << "\r\n"
+        << "Cache-Control: no-cache\r\n"
+        << "ETag: " << etag << "\r\n"
+        << "Vary: Accept-Encoding\r\n";
+    if (gzip) {
+      oss << "Content-Encoding: gzip\r\n";
+    }
+    if (!not_modified) {
+      oss << "Content-Length: " << body.size() << "\r\n";
+    }
+    oss << "Connection: " << (request.keep_alive ? "keep-alive" : "close") << "\r\n\r\n";
+    const std::string header = oss.str();
+
+    // ヘッダと本文を1回のsendmsg()で送る
+    iovec iov[2];
+    iov[0].iov_base = const_cast<char *>(header.data());
+    iov[0].iov_len = header.size();
+    iov[1].iov_base = const_cast<char *>(body.data());
+    iov[1].iov_len = not_modified ? 0 : body.size();
+    const bool ok = send_iov(client_fd, iov, 2);
+    return ok && request.keep_alive;
+  }
+
+ private:
+  struct Asset {
+    std::string body;
+    std::string gzip_body;  // 小さくならなければ空
+    std::string etag;
+    std::string gzip_etag;
+    int64_t mtime_ns = 0;
+    off_t size = 0;
+  };
+
+  struct Entry {
+    std::string path;
+    const char *content_type = "text/plain";
+    std::shared_ptr<const Asset> asset;
+  };
+
+  // mutex_を保持して呼ぶ
+  static void refresh(Entry &entry) {
+    struct stat st {};
+    if (::stat(entry.path.c_str(), &st) != 0) {
+      return;  // 消えた場合は読み込み済みの内容を出し続ける
+    }
+    const int64_t mtime_ns =
+        static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+    if (entry.asset && entry.asset->mtime_ns == mtime_ns &&
+        entry.asset->size == st.st_size) {
+      return;
+    }
+    std::ifstream file(entry.path, std::ios::binary);
+    if (!file) {
+      return;
+    }
+    auto asset = std::make_shared<Asset>();
+    std::ostringstream content;
+    content << file.rdbuf();
+    asset->body = content.str();
+    asset->mtime_ns = mtime_ns;
+    asset->size = st.st_size;
+
+    // FNV-1a
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c : asset->body) {
+      hash = (hash ^ c) * 1099511628211ULL;
+    }
+    char etag[24];
+    std::snprintf(etag, sizeof(etag), "%016llx",
+                  static_cast<unsigned long long>(hash));
+    asset->etag = std::string("\"") + etag + "\"";
+    asset->gzip_etag = std::string("\"") + etag + "-gz\"";
+
+    asset->gzip_body = gzip_compress(asset->body);
+    if (asset->gzip_body.size() >= asset->body.size()) {
+      asset->gzip_body.clear();
+    }
+    if (entry.asset) {
+      std::cout << "[ui] reloaded " << entry.path << std::endl;
+    }
+    entry.asset = std::move(asset);
+  }
+
+  std::string directory_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+};
 
 int create_server_socket(uint16_t port) {
   int fd = ::socket(AF_INET, SOCK_STREAM, 0);
@@ -1018,18 +4638,121 @@ int create_server_socket(uint16_t port) {
     ::close(fd);
     throw std::runtime_error("bind() failed");
   }
-  if (::listen(fd, 4) < 0) {
+  if (::listen(fd, SOMAXCONN) < 0) {
     ::close(fd);
     throw std::runtime_error("listen() failed");
   }
   return fd;
 }
 
+// APP_DUMP_TENSOR=<パス> のとき、人が検出された最初の推論フレームのYOLOv8出力（output0）を
+// 生のまま1回だけ書き出す（output-tensor-meta=1 で付くテンソル）。FP32なら [84][8400] の
+// float、FP16ならhalf。yolov8_parser_bench --tensor で読めるパーサーのテスト用の録画
+void maybe_dump_output_tensor(const NvDsFrameMeta *frame_meta) {
+  static const char *path = std::getenv("APP_DUMP_TENSOR");
+  static bool done = false;
+  if (!path || *path == '\0' || done || !frame_meta->obj_meta_list) {
+    return;
+  }
+  for (NvDsMetaList *l_user = frame_meta->frame_user_meta_list; l_user; l_user = l_user->next) {
+    const NvDsUserMeta *user_meta = static_cast<NvDsUserMeta *>(l_user->data);
+    if (user_meta->base_meta.meta_type != NVDSINFER_TENSOR_OUTPUT_META) {
+      continue;
+    }
+    const auto *tensor_meta = static_cast<NvDsInferTensorMeta *>(user_meta->user_meta_data);
+    for (unsigned int i = 0; i < tensor_meta->num_output_layers; ++i) {
+      const NvDsInferLayerInfo &layer = tensor_meta->output_layers_info[i];
+      if (std::strcmp(layer.layerName, "output0") != 0 || !tensor_meta->out_buf_ptrs_host[i]) {
+        continue;
+      }
+      const size_t element_size = layer.dataType == HALF ? 2 : 4;
+      const size_t bytes = static_cast<size_t>(layer.inferDims.numElements) * element_size;
+      done = true;
+      std::ofstream file(path, std::ios::binary);
+      if (!file.write(static_cast<const char *>(tensor_meta->out_buf_ptrs_host[i]),
+                      static_cast<std::streamsize>(bytes))) {
+        std::cerr << "[tensor] Failed to write " << path << std::endl;
+        return;
+      }
+      std::cout << "[tensor] Wrote output0 (" << (layer.dataType == HALF ? "FP16" : "FP32")
+                << ", " << bytes << " bytes) to " << path << std::endl;
+      return;
+    }
+  }
+}
+
+void extract_detections(GstBuffer *buffer, FrameDetections &out) {
+  out.detections.clear();
+  out.pts = GST_BUFFER_PTS(buffer);
+  NvDsBatchMeta *batch_meta = gst_buffer_get_nvds_batch_meta(buffer);
+  if (!batch_meta) {
+    return;
+  }
+  for (NvDsMetaList *l_frame = batch_meta->frame_meta_list; l_frame;
+       l_frame = l_frame->next) {
+    NvDsFrameMeta *frame_meta = static_cast<NvDsFrameMeta *>(l_frame->data);
+    out.frame_size.width = static_cast<int>(frame_meta->pipeline_width);
+    out.frame_size.height = static_cast<int>(frame_meta->pipeline_height);
+    out.pts = frame_meta->buf_pts;
+    maybe_dump_output_tensor(frame_meta);
+    for (NvDsMetaList *l_obj = frame_meta->obj_meta_list; l_obj;
+         l_obj = l_obj->next) {
+      NvDsObjectMeta *obj_meta = static_cast<NvDsObjectMeta *>(l_obj->data);
+
+      Detection d;
+      d.tracking_id = obj_meta->object_id;
+      d.class_id = obj_meta->class_id;
+      d.confidence = obj_meta->confidence;
+      d.left = obj_meta->rect_params.left;
+      d.top = obj_meta->rect_params.top;
+      d.width = obj_meta->rect_params.width;
+      d.height = obj_meta->rect_params.height;
+      out.detections.push_back(d);
+    }
+  }
+}
+
+// 検出結果を固定ID付きで配信先へ渡す。
+// meta=1の視聴者がいれば同じPTSのJPEGに紐付け、/api/events の購読者と
+// クリップ用リングにも最新値を渡す
+void publish_frame_detections(const FrameDetections &frame,
+                              const DetectionStore &detection_store,
+                              FrameStore &frame_store, ClipRecorder &clip_recorder,
+                              EventStream &event_stream, DetectionJsonCache &detection_json,
+                              DetectionBinaryCache &detection_binary, JsonWriter &json) {
+  const bool wants_meta = frame_store.wants_meta();
+  const bool wants_events = event_stream.wants_detections();
+  if (!wants_meta && !wants_events && !clip_recorder.enabled()) {
+    return;
+  }
+  if (wants_events) {
+    // /api/detections と同じ版のJSONを共有する（版ごとに1回だけ直列化）
+    uint64_t version = 0;
+    std::shared_ptr<const std::string> json_body = detection_json.get(version);
+    event_stream.publish_detections(std::move(json_body), version, detection_binary);
+  }
+  if (!wants_meta && !clip_recorder.enabled()) {
+    return;
+  }
+  const DetectionStore::SnapshotPtr snapshot = detection_store.snapshot();
+  if (clip_recorder.enabled()) {
+    clip_recorder.set_detections(snapshot->detections);
+  }
+  if (wants_meta) {
+    frame_store.annotate(frame.pts, [&](uint64_t sequence) {
+      write_frame_meta_json(json, sequence, snapshot->detections, frame.frame_size);
+      return json.str();
+    });
+  }
+}
+
 }  // namespace
 
 int main() {
   std::signal(SIGINT, signal_handler);
   std::signal(SIGTERM, signal_handler);
+  // sendfile()にはMSG_NOSIGNALがないので、切断されたソケットへの送信はEPIPEで受ける
+  std::signal(SIGPIPE, SIG_IGN);
 
   gst_init(nullptr, nullptr);
 
@@ -1075,10 +4798,111 @@ int main() {
   gst_app_sink_set_max_buffers(appsink, 1);
   gst_app_sink_set_drop(appsink, TRUE);
 
+  // メタデータ専用のappsink（あればDetectionStoreはこちらから更新する）
+  GstElement *meta_sink_elem =
+      gst_bin_get_by_name(GST_BIN(pipeline), "meta_sink");
+  GstAppSink *meta_sink =
+      meta_sink_elem ? GST_APP_SINK(meta_sink_elem) : nullptr;
+  if (meta_sink) {
+    gst_app_sink_set_max_buffers(meta_sink, 1);
+    gst_app_sink_set_drop(meta_sink, TRUE);
+  }
+
+  // プレビュー（OSD/JPEGエンコード）ブランチのvalve。視聴者がいない間は閉じる
+  GstElement *preview_valve =
+      gst_bin_get_by_name(GST_BIN(pipeline), "preview_valve");
+
   FrameStore frame_store;
-  DetectionStore detection_store;
-  
-  std::thread sample_thread([appsink, &frame_store, &detection_store]() {
+  DetectionStore detection_store(env_int("APP_MAX_PERSONS", DetectionStore::kDefaultMaxPersons));
+  ClipRecorder clip_recorder(clip_config_from_env());
+  ClipSender clip_sender;
+  if (preview_valve) {
+    g_object_set(G_OBJECT(preview_valve), "drop", TRUE, nullptr);
+    frame_store.set_viewer_callback([preview_valve](bool watching) {
+      g_object_set(G_OBJECT(preview_valve), "drop", watching ? FALSE : TRUE,
+                   nullptr);
+      std::cout << "[stream] Preview encoding "
+                << (watching ? "resumed" : "paused") << std::endl;
+    });
+  }
+  if (clip_recorder.start()) {
+    clip_sender.start();
+    detection_store.set_alert_listener([&clip_recorder](const Alert &alert) {
+      clip_recorder.on_alert(alert);
+    });
+    // アラート前の映像を残すには常にフレームが要るので、クリップ有効中はvalveを閉じない。
+    // プレビューブランチはカメラのJPEGを通すだけ（再エンコードなし）なので、
+    // 常時開いていてもコストはリングへのコピー（640x480で約1MB/秒）程度
+    frame_store.add_viewer(false);
+    std::cout << "[clip] Preview branch stays open for the pre-alert ring "
+              << "(APP_CLIP_MEMORY_MB=0 lets it pause without viewers)" << std::endl;
+  }
+  MjpegStreamer mjpeg_streamer(frame_store);
+  if (!mjpeg_streamer.start()) {
+    if (meta_sink_elem) {
+      gst_object_unref(meta_sink_elem);
+    }
+    if (preview_valve) {
+      gst_object_unref(preview_valve);
+    }
+    gst_object_unref(appsink_elem);
+    gst_object_unref(pipeline);
+    return 1;
+  }
+
+  // /api/events（検出結果はAPP_EVENTS_HZまで間引く。0なら毎フレーム）
+  EventStream event_stream(detection_store, env_int("APP_EVENTS_HZ", 10));
+  const bool events_enabled = event_stream.start();
+  DetectionJsonCache detection_json(detection_store);
+  DetectionBinaryCache detection_binary(detection_store);
+  if (events_enabled) {
+    detection_store.set_change_listener([&event_stream]() {
+      event_stream.notify_state_changed();
+    });
+  }
+
+  // 追跡・異常検知と配信は解析スレッドで行い、appsinkのスレッドは
+  // メタデータをリングへ写すだけにする（遅い解析でサンプルを落とさない）
+  DetectionRing detection_ring;
+  std::thread analytics_thread([&detection_ring, &frame_store, &detection_store,
+                                &clip_recorder, &event_stream, &detection_json,
+                                &detection_binary]() {
+    JsonWriter json;
+    while (g_running.load()) {
+      FrameDetections *frame = detection_ring.front(500);
+      if (!frame) {
+        continue;
+      }
+      detection_store.update(frame->detections, frame->frame_size);
+      publish_frame_detections(*frame, detection_store, frame_store, clip_recorder,
+                               event_stream, detection_json, detection_binary, json);
+      detection_ring.pop();
+    }
+  });
+
+  std::thread meta_thread;
+  if (meta_sink) {
+    meta_thread = std::thread([meta_sink, &detection_ring]() {
+      while (g_running.load()) {
+        GstSample *sample =
+            gst_app_sink_try_pull_sample(meta_sink, GST_SECOND / 2);
+        if (!sample) {
+          continue;
+        }
+        GstBuffer *buffer = gst_sample_get_buffer(sample);
+        FrameDetections *frame = buffer ? detection_ring.begin_push() : nullptr;
+        if (frame) {
+          extract_detections(buffer, *frame);
+          detection_ring.commit_push();
+        }
+        gst_sample_unref(sample);
+      }
+    });
+  }
+
+  const bool preview_has_meta = (meta_sink == nullptr);
+  std::thread sample_thread([appsink, preview_has_meta, &frame_store,
+                             &clip_recorder, &detection_ring]() {
     while (g_running.load()) {
       GstSample *sample =
           gst_app_sink_try_pull_sample(appsink, GST_SECOND / 2);
@@ -1087,38 +4911,19 @@ int main() {
       }
       GstBuffer *buffer = gst_sample_get_buffer(sample);
       if (buffer) {
-        // Extract DeepStream metadata
-        std::vector<Detection> detections;
-        NvDsBatchMeta *batch_meta = gst_buffer_get_nvds_batch_meta(buffer);
-        if (batch_meta) {
-          for (NvDsMetaList *l_frame = batch_meta->frame_meta_list; l_frame;
-               l_frame = l_frame->next) {
-            NvDsFrameMeta *frame_meta =
-                static_cast<NvDsFrameMeta *>(l_frame->data);
-            for (NvDsMetaList *l_obj = frame_meta->obj_meta_list; l_obj;
-                 l_obj = l_obj->next) {
-              NvDsObjectMeta *obj_meta =
-                  static_cast<NvDsObjectMeta *>(l_obj->data);
-              
-              Detection d;
-              d.tracking_id = obj_meta->object_id;
-              d.class_id = obj_meta->class_id;
-              d.confidence = obj_meta->confidence;
-              d.left = obj_meta->rect_params.left;
-              d.top = obj_meta->rect_params.top;
-              d.width = obj_meta->rect_params.width;
-              d.height = obj_meta->rect_params.height;
-              detections.push_back(d);
-            }
-          }
-        }
-        detection_store.update(detections);
-        
         // Extract JPEG frame
-        GstMapInfo map;
-        if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
-          frame_store.update(map.data, map.size);
-          gst_buffer_unmap(buffer, &map);
+        JpegFramePtr jpeg = JpegFrame::wrap(buffer);
+        if (jpeg && clip_recorder.enabled()) {
+          clip_recorder.add_frame(*jpeg);
+        }
+        frame_store.update(std::move(jpeg));
+
+        // meta_sinkがないパイプラインではpreview_sinkのメタデータを使う
+        FrameDetections *frame = preview_has_meta ? detection_ring.begin_push() : nullptr;
+        if (frame) {
+          extract_detections(buffer, *frame);
+          frame->pts = GST_BUFFER_PTS(buffer);  // このJPEG自身と対応付ける
+          detection_ring.commit_push();
         }
       }
       gst_sample_unref(sample);
@@ -1163,6 +4968,12 @@ int main() {
     }
   });
 
+  const char *ui_dir = std::getenv("APP_UI_DIR");
+  StaticAssets ui_assets((ui_dir && *ui_dir) ? ui_dir : "/workspace/edge-room-monitor/ui");
+  ui_assets.add("monitor", "monitor.html", "text/html; charset=utf-8");
+  ui_assets.add("old", "mjpeg_viewer.html", "text/html; charset=utf-8");
+  ui_assets.add("debug", "debug.html", "text/html; charset=utf-8");
+
   int server_fd = -1;
   try {
     const uint16_t port = resolve_port(std::getenv("APP_HTTP_PORT"));
@@ -1174,49 +4985,50 @@ int main() {
     std::cerr << ex.what() << std::endl;
   }
 
-  std::thread accept_thread;
+  HttpServer::Config http_config;
+  http_config.workers = env_int("APP_HTTP_WORKERS", 4);
+  http_config.idle_timeout_sec = env_int("APP_HTTP_IDLE_SEC", 15);
+  http_config.long_poll_sec = env_int("APP_HTTP_LONG_POLL_SEC", 25);
+  HttpServer http_server(http_config);
   if (server_fd >= 0) {
-    accept_thread = std::thread([server_fd, &frame_store, &detection_store]() {
-      while (g_running.load()) {
-        sockaddr_in addr {};
-        socklen_t len = sizeof(addr);
-        int client = ::accept(server_fd, reinterpret_cast<sockaddr *>(&addr),
-                              &len);
-        if (client < 0) {
-          if (errno == EINTR) {
-            continue;
-          }
-          std::cerr << "accept() failed: " << std::strerror(errno) << std::endl;
-          break;
-        }
-        
-        // Read HTTP request
-        std::string request = read_http_request(client);
-        if (request.empty()) {
-          ::close(client);
-          continue;
-        }
-        
-        // std::cout << "[http] " << request.substr(0, request.find('\r')) << std::endl;
-        
-        if (is_api_request(request)) {
-          std::thread(serve_api_client, client, request,
-                      std::ref(detection_store)).detach();
-        } else if (request.find("GET /stream") == 0) {
-          std::thread(serve_mjpeg_client, client, std::ref(frame_store)).detach();
-        } else if (request.find("GET /debug") == 0) {
-          std::thread(serve_html_file, client, 
-                      std::string("/workspace/edge-room-monitor/ui/debug.html")).detach();
-        } else if (request.find("GET /old") == 0) {
-          std::thread(serve_html_file, client, 
-                      std::string("/workspace/edge-room-monitor/ui/mjpeg_viewer.html")).detach();
-        } else {
-          // Default: serve monitoring UI
-          std::thread(serve_html_file, client, 
-                      std::string("/workspace/edge-room-monitor/ui/monitor.html")).detach();
-        }
+    auto route = [&mjpeg_streamer, &event_stream, events_enabled, &detection_store,
+                  &detection_json, &detection_binary, &detection_ring, &clip_recorder,
+                  &clip_sender, &ui_assets, &http_server](
+                     int client, const HttpRequest &request) {
+      using Result = HttpServer::Result;
+      // std::cout << "[http] " << request.method << " " << request.target << std::endl;
+      const std::string_view path = request.path;
+      bool kept = false;
+      if (events_enabled && path == "/api/events") {
+        event_stream.add_client(client, request.query_param("detections") != "0",
+                                request.query_param("format") == "bin");
+        return Result::Detached;
+      } else if (path.substr(0, 5) == "/api/") {
+        return serve_api_client(client, request, detection_store, detection_json,
+                                detection_binary, detection_ring, clip_recorder,
+                                clip_sender, http_server);
+      } else if (path == "/stream") {
+        mjpeg_streamer.add_client(client, request.query_param("meta") == "1");
+        return Result::Detached;
+      } else if (path.substr(0, 6) == "/debug") {
+        kept = ui_assets.serve(client, "debug", request);
+      } else if (path.substr(0, 4) == "/old") {
+        kept = ui_assets.serve(client, "old", request);
+      } else {
+        // Default: serve monitoring UI
+        kept = ui_assets.serve(client, "monitor", request);
       }
-    });
+      return kept ? Result::KeepAlive : Result::Close;
+    };
+    if (!http_server.start(server_fd, route)) {
+      ::close(server_fd);
+      server_fd = -1;
+    } else {
+      // ?since=&wait=1 で保留中のリクエストを、版が進んだら再処理する
+      detection_store.set_version_listener([&http_server]() {
+        http_server.notify_waiters();
+      });
+    }
   }
 
   GstStateChangeReturn state_ret =
@@ -1232,21 +5044,36 @@ int main() {
 
   gst_element_set_state(pipeline, GST_STATE_NULL);
 
+  detection_store.set_version_listener(nullptr);
+  http_server.stop();
   if (server_fd >= 0) {
-    ::shutdown(server_fd, SHUT_RDWR);
     ::close(server_fd);
   }
 
-  if (accept_thread.joinable()) {
-    accept_thread.join();
-  }
   if (bus_thread.joinable()) {
     bus_thread.join();
   }
   if (sample_thread.joinable()) {
     sample_thread.join();
   }
+  if (meta_thread.joinable()) {
+    meta_thread.join();
+  }
+  if (analytics_thread.joinable()) {
+    analytics_thread.join();
+  }
+  clip_recorder.stop();
+  clip_sender.stop();
+  mjpeg_streamer.stop();
+  detection_store.set_change_listener(nullptr);
+  event_stream.stop();
 
+  if (meta_sink_elem) {
+    gst_object_unref(meta_sink_elem);
+  }
+  if (preview_valve) {
+    gst_object_unref(preview_valve);
+  }
   gst_object_unref(appsink_elem);
   gst_object_unref(bus);
   gst_object_unref(pipeline);
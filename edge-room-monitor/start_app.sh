@@ -75,6 +75,23 @@ start_container() {
   if [[ -n "${PIPELINE_CONFIG:-}" ]]; then
     env_args+=(-e "PIPELINE_CONFIG=$PIPELINE_CONFIG")
   fi
+  if [[ -n "${YOLOV8_NMS_IOU:-}" ]]; then
+    env_args+=(-e "YOLOV8_NMS_IOU=$YOLOV8_NMS_IOU")
+  fi
+  if [[ -n "${YOLOV8_PARSER_STATS:-}" ]]; then
+    env_args+=(-e "YOLOV8_PARSER_STATS=$YOLOV8_PARSER_STATS")
+  fi
+  if [[ -n "${YOLOV8_NMS_TOPK:-}" ]]; then
+    env_args+=(-e "YOLOV8_NMS_TOPK=$YOLOV8_NMS_TOPK")
+  fi
+  local opt_var
+  for opt_var in APP_CLIP_MEMORY_MB APP_CLIP_PRE_SEC APP_CLIP_POST_SEC APP_CLIP_DIR \
+                 APP_HTTP_WORKERS APP_HTTP_IDLE_SEC APP_HTTP_LONG_POLL_SEC APP_EVENTS_HZ \
+                 APP_MAX_PERSONS; do
+    if [[ -n "${!opt_var:-}" ]]; then
+      env_args+=(-e "$opt_var=${!opt_var}")
+    fi
+  done
 
   "${DOCKER[@]}" run -d \
     --name "$CONTAINER_NAME" \
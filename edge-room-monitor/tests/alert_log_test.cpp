@@ -0,0 +1,146 @@
+// アラートのリング（AlertLog）とDetectionStoreのアラート処理、alerts_to_jsonの試験。
+//   ./alert_log_test
+// リングの容量を超えてアラートを積み、IDが増え続けること・保持数が容量で止まること・
+// first_idが最古の保持IDになること、(固定ID, 種類)ごとの重複抑止（last_alert_）、
+// あふれたIDやclear_alerts後のIDの確認が404になることを確認する。
+// どれかが想定どおりでなければ終了コード1
+#include "app_under_test.h"
+
+#include <cstdio>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// DetectionStoreのfriend。update()で姿勢を作らずにアラートを積む
+struct DetectionStoreTestAccess {
+  static bool add_alert(DetectionStore &store, int fixed_id, AlertType type,
+                        Clock::time_point timestamp) {
+    DetectionStore::WriteLock lock(store);
+    return store.add_alert(fixed_id, type, "test", timestamp);
+  }
+};
+
+bool g_ok = true;
+
+void expect(bool condition, const char *what) {
+  std::printf("%-60s %s\n", what, condition ? "ok" : "FAILED");
+  g_ok &= condition;
+}
+
+uint64_t json_uint(const std::string &json, const char *key) {
+  const std::string needle = std::string("\"") + key + "\":";
+  const size_t pos = json.find(needle);
+  return pos == std::string::npos ? UINT64_MAX
+                                  : std::strtoull(json.c_str() + pos + needle.size(), nullptr, 10);
+}
+
+// /api/acknowledge_alert を直接呼んだときのステータス
+std::string acknowledge(DetectionStore &store, uint64_t id) {
+  DetectionJsonCache detection_json(store);
+  DetectionBinaryCache detection_binary(store);
+  DetectionRing detection_ring;
+  ClipRecorder clip_recorder(ClipRecorder::Config{});
+  ClipSender clip_sender;
+  HttpServer http_server(HttpServer::Config{});
+  HttpRequest request;
+  const std::string body = "{\"id\":" + std::to_string(id) + "}";
+  request.body = body;
+  ApiContext ctx{-1, request, store, detection_json, detection_binary, detection_ring,
+                 clip_recorder, clip_sender, http_server};
+  return api_post_acknowledge_alert(ctx).status;
+}
+
+// 30秒より離れた時刻で積めば重複抑止にかからない
+void check_ring() {
+  constexpr size_t kCapacity = AlertLog::kDefaultCapacity;
+  DetectionStore store;
+  const auto t0 = Clock::now();
+  bool added = true;
+  bool increasing = true;
+  bool bounded = true;
+  uint64_t last_id = 0;
+  const size_t total = 3 * kCapacity + 10;
+  for (size_t i = 0; i < total; ++i) {
+    added &= DetectionStoreTestAccess::add_alert(store, static_cast<int>(i % 4), ALERT_FALL,
+                                                 t0 + std::chrono::seconds(31 * i));
+    const auto alerts = store.get_alerts();
+    bounded &= alerts->size() == std::min(i + 1, kCapacity);
+    increasing &= alerts->back().id > last_id;
+    last_id = alerts->back().id;
+  }
+  const auto alerts = store.get_alerts();
+  bool consecutive = true;
+  for (size_t i = 1; i < alerts->size(); ++i) {
+    consecutive &= (*alerts)[i].id == (*alerts)[i - 1].id + 1;
+  }
+  const std::string json = alerts_to_json(*store.snapshot());
+  std::printf("%zu alerts pushed, %zu kept, ids %llu..%llu, first_id %llu\n", total,
+              alerts->size(), static_cast<unsigned long long>(alerts->front().id),
+              static_cast<unsigned long long>(alerts->back().id),
+              static_cast<unsigned long long>(json_uint(json, "first_id")));
+  expect(added, "every alert 31 s apart is added");
+  expect(increasing && consecutive && last_id == total, "IDs keep increasing past the ring size");
+  expect(bounded, "the ring never holds more than its capacity");
+  expect(json_uint(json, "first_id") == total - kCapacity + 1,
+         "first_id is the oldest ID still held");
+
+  expect(acknowledge(store, 1) == "404 Not Found", "acknowledging an evicted ID is 404");
+  expect(acknowledge(store, total - kCapacity) == "404 Not Found",
+         "acknowledging the newest evicted ID is 404");
+  expect(acknowledge(store, total - kCapacity + 1) == "200 OK",
+         "acknowledging the oldest held ID is 200");
+  expect(acknowledge(store, total + 1) == "404 Not Found", "acknowledging a future ID is 404");
+
+  store.clear_alerts();
+  const std::string cleared = alerts_to_json(*store.snapshot());
+  expect(acknowledge(store, total) == "404 Not Found",
+         "acknowledge-by-ID after clear_alerts is 404");
+  expect(json_uint(cleared, "first_id") == 0, "first_id is 0 when nothing is held");
+  DetectionStoreTestAccess::add_alert(store, 0, ALERT_FALL, Clock::now());
+  const std::string after = alerts_to_json(*store.snapshot());
+  expect(store.get_alerts()->size() == 1 && store.get_alerts()->front().id == total + 1 &&
+             json_uint(after, "first_id") == total + 1,
+         "IDs are not reused after clear_alerts");
+}
+
+void check_dedup() {
+  constexpr size_t kCapacity = AlertLog::kDefaultCapacity;
+  DetectionStore store;
+  const auto t0 = Clock::now();
+  const auto at = [t0](int seconds) { return t0 + std::chrono::seconds(seconds); };
+  using Access = DetectionStoreTestAccess;
+
+  expect(Access::add_alert(store, 1, ALERT_FALL, at(0)), "first (1, FALL) is added");
+  expect(!Access::add_alert(store, 1, ALERT_FALL, at(5)),
+         "(1, FALL) again within 30 s is a duplicate");
+  expect(Access::add_alert(store, 1, ALERT_BED_EXIT, at(5)), "(1, BED_EXIT) is a different key");
+  expect(Access::add_alert(store, 2, ALERT_FALL, at(5)), "(2, FALL) is a different key");
+  expect(Access::add_alert(store, 1, ALERT_FALL, at(31)), "(1, FALL) after 30 s is added");
+
+  const uint64_t latest = store.get_alerts()->back().id;
+  expect(acknowledge(store, latest) == "200 OK", "acknowledge the latest alert");
+  expect(Access::add_alert(store, 1, ALERT_FALL, at(32)),
+         "(1, FALL) right after acknowledging is added");
+
+  // 最後のアラートがリングからあふれていれば、30秒以内でも新しく出す
+  expect(Access::add_alert(store, 3, ALERT_FALL, at(40)), "first (3, FALL) is added");
+  for (size_t i = 0; i < kCapacity; ++i) {
+    Access::add_alert(store, 0, ALERT_LYING_FLOOR, at(41 + 31 * static_cast<int>(i)));
+  }
+  expect(Access::add_alert(store, 3, ALERT_FALL, at(45)),
+         "(3, FALL) is added again once its last alert was evicted");
+
+  // clear_alertsでlast_alert_も消えるので、直後の同じ種類も出る
+  store.clear_alerts();
+  expect(Access::add_alert(store, 1, ALERT_FALL, at(33)), "(1, FALL) is added after clear_alerts");
+}
+
+}  // namespace
+
+int main() {
+  std::cout.setstate(std::ios::failbit);  // アラートのログを捨てる
+  check_ring();
+  check_dedup();
+  return g_ok ? 0 : 1;
+}
@@ -0,0 +1,9 @@
+// Compiles src/main.cpp into a test binary. Everything in main.cpp lives in an
+// anonymous namespace, so including it (with main renamed) is how tests reach
+// DetectionStore, JsonWriter, HttpRequestParser and the rest. Link
+// tests/stub/gst_stub.cpp and zlib.
+#pragma once
+
+#define main edge_room_monitor_main
+#include "main.cpp"
+#undef main
@@ -0,0 +1,161 @@
+// アラートクリップ送信（ClipSender）のループバック試験。
+//   ./clip_sender_test [file_mb]
+// 読まないクライアントkMaxTransfers個へ大きなクリップを渡し、send()がすぐ戻ること
+// （HTTPワーカーを塞がないこと）、上限を超えた分がBusyになること、1つを読み切ると
+// ヘッダとファイルの中身がそのまま届くこと、切断で枠が空くことを確認する。
+// どれかが想定どおりでなければ終了コード1
+#include "app_under_test.h"
+
+#include <cstdio>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr double kMaxSendCallMs = 50.0;
+
+bool g_ok = true;
+
+void expect(bool condition, const char *what) {
+  std::printf("%-52s %s\n", what, condition ? "ok" : "FAILED");
+  g_ok &= condition;
+}
+
+// 127.0.0.1の空きポートで待ち受ける
+int listen_loopback(sockaddr_in &addr) {
+  const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  addr = sockaddr_in {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, 64) != 0 ||
+      ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+    std::perror("listen");
+    std::exit(1);
+  }
+  return fd;
+}
+
+// クライアント側とサーバ側のfdの組
+std::pair<int, int> connect_pair(int listen_fd, const sockaddr_in &addr) {
+  const int client = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (::connect(client, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0) {
+    std::perror("connect");
+    std::exit(1);
+  }
+  return {client, ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC)};
+}
+
+std::string read_all(int fd) {
+  std::string data;
+  char buffer[65536];
+  for (;;) {
+    const ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return data;
+    }
+    data.append(buffer, static_cast<size_t>(n));
+  }
+}
+
+bool wait_until_idle(const ClipSender &sender) {
+  const auto deadline = Clock::now() + std::chrono::seconds(5);
+  while (sender.active() != 0 && Clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return sender.active() == 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const size_t file_bytes = static_cast<size_t>(argc > 1 ? std::atol(argv[1]) : 16) << 20;
+  std::signal(SIGPIPE, SIG_IGN);
+
+  // ソケットバッファに収まらない大きさのクリップ
+  char path[] = "/tmp/clip_sender_test_XXXXXX";
+  const int file_fd = ::mkstemp(path);
+  std::string content(file_bytes, '\0');
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = static_cast<char>((i * 31) >> 3);
+  }
+  if (file_fd < 0 || ::write(file_fd, content.data(), content.size()) !=
+                         static_cast<ssize_t>(content.size())) {
+    std::perror("write clip");
+    return 1;
+  }
+  ::close(file_fd);
+
+  ClipSender sender;
+  if (!sender.start()) {
+    return 1;
+  }
+  sockaddr_in addr {};
+  const int listen_fd = listen_loopback(addr);
+
+  // 読まないクライアントで上限まで埋める。send()はファイルを開いて渡すだけで戻る
+  std::vector<int> clients;
+  double slowest_ms = 0.0;
+  bool started = true;
+  for (size_t i = 0; i < ClipSender::kMaxTransfers; ++i) {
+    const auto [client, server] = connect_pair(listen_fd, addr);
+    clients.push_back(client);
+    const auto start = Clock::now();
+    started &= sender.send(server, path, "video/x-msvideo") == ClipSender::Start::Started;
+    slowest_ms = std::max(slowest_ms, std::chrono::duration<double, std::milli>(
+                                          Clock::now() - start).count());
+  }
+  std::printf("%zu stalled %zu MB transfers, slowest send() %.2f ms\n",
+              ClipSender::kMaxTransfers, file_bytes >> 20, slowest_ms);
+  expect(started, "every transfer up to the cap starts");
+  expect(slowest_ms < kMaxSendCallMs, "send() returns without waiting for the client");
+
+  {
+    const auto [client, server] = connect_pair(listen_fd, addr);
+    expect(sender.send(server, path, "video/x-msvideo") == ClipSender::Start::Busy,
+           "one more transfer is refused (Busy)");
+    expect(sender.send(server, "/nonexistent/clip.avi", "video/x-msvideo") ==
+               ClipSender::Start::Busy,
+           "still Busy before the file is even opened");
+    ::close(server);
+    ::close(client);
+  }
+
+  // 1つ目を読み切る: ヘッダ + ファイルの中身、その後切断
+  const std::string received = read_all(clients[0]);
+  ::close(clients[0]);
+  const size_t header_end = received.find("\r\n\r\n");
+  const std::string expected_length = "Content-Length: " + std::to_string(file_bytes) + "\r\n";
+  expect(received.compare(0, 17, "HTTP/1.1 200 OK\r\n") == 0, "status line");
+  expect(header_end != std::string::npos &&
+             received.find(expected_length) < header_end &&
+             received.find("Connection: close\r\n") < header_end,
+         "Content-Length and Connection: close");
+  expect(header_end != std::string::npos &&
+             received.compare(header_end + 4, std::string::npos, content) == 0,
+         "body is the file, byte for byte");
+
+  // 読まないまま切断すると枠が空く
+  for (size_t i = 1; i < clients.size(); ++i) {
+    ::close(clients[i]);
+  }
+  expect(wait_until_idle(sender), "closing the stalled clients frees every slot");
+  {
+    const auto [client, server] = connect_pair(listen_fd, addr);
+    expect(sender.send(server, "/nonexistent/clip.avi", "video/x-msvideo") ==
+               ClipSender::Start::NotFound,
+           "a missing file is NotFound and sends nothing");
+    expect(sender.active() == 0, "NotFound does not hold a slot");
+    ::close(server);
+    ::close(client);
+  }
+
+  sender.stop();
+  ::close(listen_fd);
+  ::unlink(path);
+  return g_ok ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+// DetectionStoreの読み書き競合ベンチマーク。
+//   ./detection_store_bench [frames] [listener_us]
+// 30Hzの書き手（解析スレッド相当のupdate()）、N本の読み手（HTTPハンドラ相当：
+// スナップショット取得＋JSON化）、5ms間隔のAPI書き込み（set_auto_register）を同時に動かし、
+// update()とAPI書き込みにかかった時間と、読み手の読み出し回数/秒を表示する。
+// listener_usを与えると版リスナーがその時間だけ眠る（通知先が重い場合の再現）
+#include "app_under_test.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double percentile_us(std::vector<double> &samples, double p) {
+  if (samples.empty()) {
+    return 0.0;
+  }
+  std::sort(samples.begin(), samples.end());
+  const size_t index = std::min(samples.size() - 1,
+                                static_cast<size_t>(p * static_cast<double>(samples.size())));
+  return samples[index];
+}
+
+double elapsed_us(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+// 4人がゆっくり動くフレーム
+std::vector<Detection> make_frame(int frame) {
+  std::vector<Detection> detections;
+  for (int i = 0; i < 4; ++i) {
+    Detection det{};
+    det.tracking_id = static_cast<uint64_t>(i + 1);
+    det.confidence = 0.9f;
+    det.left = 40.0f + 140.0f * static_cast<float>(i) + static_cast<float>(frame % 20);
+    det.top = 100.0f;
+    det.width = 80.0f;
+    det.height = 220.0f;
+    detections.push_back(det);
+  }
+  return detections;
+}
+
+void run(int readers, int frames, int listener_us) {
+  DetectionStore store;
+  if (listener_us > 0) {
+    store.set_version_listener([listener_us]() {
+      std::this_thread::sleep_for(std::chrono::microseconds(listener_us));
+    });
+  }
+
+  std::atomic<bool> running{true};
+  std::atomic<uint64_t> reads{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < readers; ++i) {
+    threads.emplace_back([&]() {
+      JsonWriter json;
+      uint64_t count = 0;
+      while (running.load(std::memory_order_relaxed)) {
+        const auto snapshot = store.snapshot();
+        json.clear();
+        write_detections_json(json, *snapshot);
+        count += store.get_alerts()->size() + 1;
+      }
+      reads += count;
+    });
+  }
+
+  std::vector<double> api_us;
+  std::thread api([&]() {
+    bool enabled = true;
+    while (running.load(std::memory_order_relaxed)) {
+      const auto start = Clock::now();
+      store.set_auto_register(enabled = !enabled);
+      api_us.push_back(elapsed_us(start));
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+  });
+
+  // 30Hz
+  std::vector<double> update_us;
+  const auto period = std::chrono::microseconds(33333);
+  const auto begin = Clock::now();
+  auto next = begin;
+  for (int frame = 0; frame < frames; ++frame) {
+    const auto detections = make_frame(frame);
+    const auto start = Clock::now();
+    store.update(detections, FrameSize{640, 480});
+    update_us.push_back(elapsed_us(start));
+    next += period;
+    std::this_thread::sleep_until(next);
+  }
+  const double seconds = elapsed_us(begin) / 1e6;
+  running = false;
+  api.join();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  std::printf("%7d %12.0f %9.1f %9.1f %9.1f %9.1f %9.1f\n", readers,
+              static_cast<double>(reads.load()) / seconds, percentile_us(update_us, 0.5),
+              percentile_us(update_us, 0.99), percentile_us(update_us, 1.0),
+              percentile_us(api_us, 0.99), percentile_us(api_us, 1.0));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const int frames = argc > 1 ? std::atoi(argv[1]) : 90;
+  const int listener_us = argc > 2 ? std::atoi(argv[2]) : 0;
+
+  // 追跡・アラートのログは計測の邪魔になるので捨てる
+  std::cout.setstate(std::ios::failbit);
+  std::printf("%d frames at 30 Hz, version listener %d us, %u hardware threads\n", frames,
+              listener_us, std::thread::hardware_concurrency());
+  std::printf("%7s %12s %9s %9s %9s %9s %9s\n", "readers", "reads/s", "upd p50", "upd p99",
+              "upd max", "api p99", "api max");
+  for (int readers : {0, 1, 4, 16}) {
+    run(readers, frames, listener_us);
+  }
+  std::printf("(times in us)\n");
+  return 0;
+}
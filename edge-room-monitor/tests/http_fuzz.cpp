@@ -0,0 +1,167 @@
+// HttpRequestParserとJSONヘルパのファズターゲット。
+//
+// clang + -DEDGE_ROOM_MONITOR_LIBFUZZER=ON ではlibFuzzerのエントリとしてビルドされる:
+//   ./http_fuzz -max_total_time=60
+// それ以外では同じ入力処理を、シードを乱数で変異させるドライバから呼ぶ
+// （ctestではASan/UBSan付きでこちらを実行）:
+//   ./http_fuzz [iterations] [seed]
+#include "app_under_test.h"
+
+#include <cstdio>
+#include <random>
+
+namespace {
+
+void check(bool condition, const char *what) {
+  if (!condition) {
+    std::fprintf(stderr, "invariant violated: %s\n", what);
+    std::abort();
+  }
+}
+
+bool inside(std::string_view part, std::string_view whole) {
+  return part.empty() ||
+         (part.data() >= whole.data() && part.data() + part.size() <= whole.data() + whole.size());
+}
+
+// 先頭から順にリクエストを取り出す（パイプライン）。Completeならrequestの各フィールドは
+// 受信バッファ内を指し、lengthバイト消費できなければならない
+void parse_all(std::string_view data, size_t first_chunk) {
+  HttpRequestParser parser;
+  HttpRequest request;
+  size_t offset = 0;
+  size_t available = std::min(first_chunk, data.size());
+  while (offset < data.size()) {
+    const std::string_view buffer = data.substr(offset, available - offset);
+    const HttpRequestParser::Status status = parser.parse(buffer, request);
+    if (status == HttpRequestParser::Status::Incomplete) {
+      if (available == data.size()) {
+        return;
+      }
+      available = data.size();  // 残りが届いた
+      continue;
+    }
+    if (status != HttpRequestParser::Status::Complete) {
+      return;
+    }
+    check(request.length > 0 && request.length <= buffer.size(), "length within buffer");
+    check(inside(request.method, buffer) && inside(request.target, buffer) &&
+              inside(request.path, buffer) && inside(request.query, buffer) &&
+              inside(request.body, buffer),
+          "fields point into the buffer");
+    check(request.header_count <= HttpRequest::kMaxHeaders, "header count");
+    check(!request.path.empty() && request.path[0] == '/', "path starts with /");
+    check(request.body.size() <= HttpRequestParser::kMaxBodyBytes, "body size");
+
+    // ルーティングとハンドラが見るもの
+    request.header("If-None-Match");
+    request.query_param("since");
+    request.query_param("wait");
+    int64_t value = 0;
+    parse_json_int(request.body, "nvtracker_id", value);
+    parse_json_int(request.body, "id", value);
+    uint64_t alert_id = 0;
+    parse_clip_path(request.path, alert_id);
+
+    offset += request.length;
+    parser.reset();
+  }
+}
+
+// 任意のバイト列をJsonWriterで文字列にしたとき、制御文字と " \ はすべてエスケープされる
+void check_json_string(std::string_view text) {
+  JsonWriter json;
+  json.begin_object().key(text).value(text).end_object();
+  const std::string &out = json.str();
+  bool in_string = false;
+  for (size_t i = 0; i < out.size(); ++i) {
+    const auto c = static_cast<unsigned char>(out[i]);
+    check(c >= 0x20, "no raw control characters");
+    if (c == '\\') {
+      check(i + 1 < out.size() && std::strchr("\"\\/bfnrtu", out[i + 1]) != nullptr,
+            "valid escape");
+      ++i;
+    } else if (c == '"') {
+      in_string = !in_string;
+    }
+  }
+  check(!in_string, "strings are closed");
+}
+
+void fuzz_one(const uint8_t *data, size_t size) {
+  const std::string_view input(reinterpret_cast<const char *>(data), size);
+  parse_all(input, input.size());
+  // 途中で分割して届いた場合も同じ結果にならなければならない
+  parse_all(input, size > 0 ? data[0] % size : 0);
+
+  int64_t value = 0;
+  if (parse_json_int(input, "id", value)) {
+    check(value > -1000000000000000000LL && value < 1000000000000000000LL, "json int range");
+  }
+  uint64_t decimal = 0;
+  parse_decimal(input, decimal);
+  check_json_string(input);
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  fuzz_one(data, size);
+  return 0;
+}
+
+#ifndef EDGE_ROOM_MONITOR_LIBFUZZER
+int main(int argc, char **argv) {
+  const long iterations = argc > 1 ? std::atol(argv[1]) : 200000;
+  const unsigned seed = argc > 2 ? static_cast<unsigned>(std::atol(argv[2])) : 1;
+
+  const std::vector<std::string> seeds = {
+      "GET /api/detections?since=12&wait=1 HTTP/1.1\r\nHost: a\r\n"
+      "If-None-Match: \"d5\"\r\nAccept: application/x-detections\r\n\r\n",
+      "POST /api/register HTTP/1.1\r\nContent-Length: 19\r\n\r\n{\"nvtracker_id\": 5}"
+      "GET /api/alerts/17/clip HTTP/1.0\r\nConnection: keep-alive\r\n\r\n",
+      "POST /api/acknowledge_alert HTTP/1.1\r\ncontent-length: 28\r\n\r\n"
+      "{\"id\":99999999999999999999}",
+      "POST /api/unregister HTTP/1.1\r\nContent-Length: 30\r\n\r\n"
+      "{\"nvtracker_id\":-9223372036854775808}",
+      "GET / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+      "{\"key\":\"\\u0000\\\"\x01\x7f\xff\"}",
+  };
+  for (const std::string &s : seeds) {
+    fuzz_one(reinterpret_cast<const uint8_t *>(s.data()), s.size());
+  }
+
+  // 変異: 1バイト置換・挿入・削除、HTTPで意味のある断片の挿入、2つのシードの連結
+  static const char *const kTokens[] = {"\r\n", "\r\n\r\n", ":", " ", "?", "&", "=", "\"",
+                                        "Content-Length: ", "99999999999", "-",
+                                        "Connection: close", "HTTP/1.1", "\\", "\t"};
+  std::mt19937 rng(seed);
+  std::string input;
+  for (long i = 0; i < iterations; ++i) {
+    input = seeds[rng() % seeds.size()];
+    if (rng() % 8 == 0) {
+      input += seeds[rng() % seeds.size()];
+    }
+    for (int edits = 1 + static_cast<int>(rng() % 6); edits > 0; --edits) {
+      const size_t pos = input.empty() ? 0 : rng() % (input.size() + 1);
+      switch (rng() % 4) {
+        case 0:
+          if (pos < input.size()) input[pos] = static_cast<char>(rng() & 0xff);
+          break;
+        case 1:
+          input.insert(pos, 1, static_cast<char>(rng() & 0xff));
+          break;
+        case 2:
+          if (pos < input.size()) input.erase(pos, 1 + rng() % 8);
+          break;
+        default:
+          input.insert(pos, kTokens[rng() % (sizeof(kTokens) / sizeof(kTokens[0]))]);
+          break;
+      }
+    }
+    fuzz_one(reinterpret_cast<const uint8_t *>(input.data()), input.size());
+  }
+  std::printf("%ld inputs OK\n", iterations + static_cast<long>(seeds.size()));
+  return 0;
+}
+#endif
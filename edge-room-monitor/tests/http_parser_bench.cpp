@@ -0,0 +1,105 @@
+// HTTPリクエストのパースとルーティングのマイクロベンチマーク（1スレッド = 1コアあたり）。
+//   ./http_parser_bench [requests]
+#include "app_under_test.h"
+
+#include <cstdio>
+
+namespace {
+
+// ブラウザのポーリングと同程度のヘッダ
+const char kPollRequest[] =
+    "GET /api/detections?since=1234&wait=1 HTTP/1.1\r\n"
+    "Host: 192.168.0.212:8080\r\n"
+    "User-Agent: Mozilla/5.0 (Linux; Android 12) AppleWebKit/537.36 Chrome/119\r\n"
+    "Accept: */*\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: ja\r\n"
+    "If-None-Match: \"d1.1234\"\r\n"
+    "Connection: keep-alive\r\n\r\n";
+
+const char kPostRequest[] =
+    "POST /api/register HTTP/1.1\r\n"
+    "Host: 192.168.0.212:8080\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 19\r\n\r\n"
+    "{\"nvtracker_id\": 5}";
+
+// 本番と同じくkApiRoutesを線形に照合する
+const ApiRoute *find_route(const HttpRequest &request) {
+  for (const ApiRoute &route : kApiRoutes) {
+    const bool path_matches =
+        route.prefix ? request.path.substr(0, route.path.size()) == route.path
+                     : request.path == route.path;
+    if (path_matches && request.method == route.method) {
+      return &route;
+    }
+  }
+  return nullptr;
+}
+
+// data を chunk バイトずつ届いたものとしてパースし、完了したリクエスト数を返す
+size_t parse_stream(const std::string &data, size_t chunk, size_t &routed) {
+  HttpRequestParser parser;
+  HttpRequest request;
+  size_t offset = 0;
+  size_t available = std::min(chunk, data.size());
+  size_t completed = 0;
+  while (offset < data.size()) {
+    const std::string_view buffer(data.data() + offset, available - offset);
+    const auto status = parser.parse(buffer, request);
+    if (status == HttpRequestParser::Status::Incomplete) {
+      if (available == data.size()) {
+        break;
+      }
+      available = std::min(available + chunk, data.size());
+      continue;
+    }
+    if (status != HttpRequestParser::Status::Complete) {
+      break;
+    }
+    routed += find_route(request) != nullptr;
+    int64_t value;
+    parse_json_int(request.body, "nvtracker_id", value);
+    ++completed;
+    offset += request.length;
+    parser.reset();
+  }
+  return completed;
+}
+
+void run(const char *name, const std::string &data, size_t chunk, long requests) {
+  size_t per_pass = 0;
+  size_t routed = 0;
+  per_pass = parse_stream(data, chunk, routed);
+  const long passes = std::max(1L, requests / static_cast<long>(per_pass));
+  const auto start = std::chrono::steady_clock::now();
+  size_t completed = 0;
+  for (long i = 0; i < passes; ++i) {
+    completed += parse_stream(data, chunk, routed);
+  }
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::printf("%-28s %12.0f req/s %8.1f ns/req %10.1f MB/s\n", name, completed / seconds,
+              seconds * 1e9 / completed,
+              static_cast<double>(data.size()) * passes / seconds / 1e6);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const long requests = argc > 1 ? std::atol(argv[1]) : 2000000;
+  const std::string poll = kPollRequest;
+  const std::string post = kPostRequest;
+  std::string pipelined;
+  for (int i = 0; i < 8; ++i) {
+    pipelined += i % 2 ? post : poll;
+  }
+
+  std::printf("%zu-byte poll, %zu-byte POST, 1 thread\n", poll.size(), post.size());
+  run("GET poll", poll, poll.size(), requests);
+  run("POST register", post, post.size(), requests);
+  run("8 pipelined", pipelined, pipelined.size(), requests);
+  run("GET poll, 64-byte reads", poll, 64, requests / 4);
+  run("GET poll, 1-byte reads", poll, 1, requests / 50);
+  return 0;
+}
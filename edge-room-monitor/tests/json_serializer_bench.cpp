@@ -0,0 +1,205 @@
+// 検出結果の直列化ベンチマーク（1スレッド）。
+//   ./json_serializer_bench [iterations]
+// 1. /stream?meta=1 のJSONパートを、以前のostringstream版とJsonWriter版で1・4・30人分作り、
+//    ns/frame・バイト数・1フレームあたりのヒープ確保回数を表示する。
+//    3桁以内の小数しか含まない入力では両者の出力が一致すること、1e15以上の値が整数で書かれることも
+//    確認する（不一致なら終了コード1）
+// 2. 版が進むたびに /api/detections が作るJSONと、バイナリ形式（キーフレーム・前の版からの差分）の
+//    バイト数とエンコード時間を比べる
+#include "app_under_test.h"
+
+#include <cstdio>
+#include <new>
+
+// プロセス全体のヒープ確保を数える。main.cppと同じ翻訳単位なので、インライン化されると
+// GCCがnew/freeの組を誤検知する（-Wmismatched-new-delete）。noinlineで避ける
+static std::atomic<uint64_t> g_allocations{0};
+
+__attribute__((noinline)) void *operator new(std::size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::size_t) noexcept {
+  std::free(p);
+}
+
+namespace {
+
+using Detections = std::vector<DetectionStore::DetectionWithFixedId>;
+
+// 以前の直列化（ostringstream）。比較用にそのまま残す
+void legacy_write_detections_json(std::ostringstream &oss, const Detections &detections) {
+  oss << "\"detections\":[";
+  for (size_t i = 0; i < detections.size(); ++i) {
+    if (i > 0) oss << ",";
+    const auto &d = detections[i].detection;
+    const int fixed_id = detections[i].fixed_id;
+    oss << "{"
+        << "\"nvtracker_id\":" << d.tracking_id << ","
+        << "\"fixed_id\":" << fixed_id << ","
+        << "\"registered\":" << (fixed_id >= 0 ? "true" : "false") << ","
+        << "\"class_id\":" << d.class_id << ","
+        << "\"confidence\":" << d.confidence << ","
+        << "\"bbox\":{\"left\":" << d.left << ",\"top\":" << d.top
+        << ",\"width\":" << d.width << ",\"height\":" << d.height << "}"
+        << "}";
+  }
+  oss << "]";
+}
+
+std::string legacy_frame_meta_to_json(uint64_t sequence, const Detections &detections,
+                                      FrameSize frame_size) {
+  std::ostringstream oss;
+  oss << "{\"sequence\":" << sequence
+      << ",\"width\":" << frame_size.width
+      << ",\"height\":" << frame_size.height << ",";
+  legacy_write_detections_json(oss, detections);
+  oss << "}";
+  return oss.str();
+}
+
+// 1/8刻みの座標と信頼度（どちらの直列化でも同じ文字列になる）
+Detections make_detections(int count) {
+  Detections detections;
+  for (int i = 0; i < count; ++i) {
+    DetectionStore::DetectionWithFixedId entry{};
+    entry.detection.tracking_id = 1000 + static_cast<uint64_t>(i);
+    entry.detection.class_id = 0;
+    entry.detection.confidence = 0.5f + 0.125f * static_cast<float>(i % 4);
+    entry.detection.left = 12.5f + 20.0f * static_cast<float>(i);
+    entry.detection.top = 40.25f + static_cast<float>(i % 7);
+    entry.detection.width = 64.0f + 0.375f * static_cast<float>(i);
+    entry.detection.height = 180.875f;
+    entry.fixed_id = i < 4 ? i : -1;
+    detections.push_back(entry);
+  }
+  return detections;
+}
+
+template <typename Fn>
+void measure(const char *name, int count, long iterations, Fn &&serialize) {
+  size_t bytes = serialize(0);  // ウォームアップ
+  const uint64_t allocations_before = g_allocations.load();
+  const auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; ++i) {
+    bytes = serialize(static_cast<uint64_t>(i));
+  }
+  const double nanos = std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - start).count();
+  const uint64_t allocations = g_allocations.load() - allocations_before;
+  std::printf("%-14s %7d %10.0f %8zu %12.2f\n", name, count, nanos / static_cast<double>(iterations),
+              bytes, static_cast<double>(allocations) / static_cast<double>(iterations));
+}
+
+// 人がゆっくり動く（1フレームで数ピクセル）ので、毎回版が進み差分で送れる
+void compare_encodings(int count, long iterations) {
+  DetectionStore store;
+  DetectionJsonCache json_cache(store);
+  DetectionBinaryCache binary_cache(store);
+  std::vector<Detection> detections;
+  for (const auto &entry : make_detections(count)) {
+    detections.push_back(entry.detection);
+  }
+  const std::vector<Detection> origin = detections;
+
+  double json_ns = 0.0;
+  double key_ns = 0.0;
+  double delta_ns = 0.0;
+  size_t json_bytes = 0;
+  size_t key_bytes = 0;
+  size_t delta_bytes = 0;
+  uint32_t previous = 0;
+  long measured = 0;
+  for (long i = 0; i <= iterations; ++i) {
+    for (size_t k = 0; k < detections.size(); ++k) {
+      detections[k].left = origin[k].left + static_cast<float>(i % 8);
+      detections[k].top = origin[k].top + static_cast<float>((i + static_cast<long>(k)) % 5);
+    }
+    store.update(detections, FrameSize{640, 480});
+
+    // エンコードだけを1回ずつ計る（steady_clockの呼び出し分は無視できる大きさ）
+    auto start = std::chrono::steady_clock::now();
+    const auto json = json_cache.get();
+    auto mid = std::chrono::steady_clock::now();
+    const DetectionBinaryCache::Encoded key = binary_cache.get(0);
+    auto key_end = std::chrono::steady_clock::now();
+    const DetectionBinaryCache::Encoded delta = binary_cache.get(previous);
+    auto end = std::chrono::steady_clock::now();
+    previous = key.version;
+    if (i == 0) {
+      continue;  // 初回は差分の基準がない
+    }
+    json_ns += std::chrono::duration<double, std::nano>(mid - start).count();
+    key_ns += std::chrono::duration<double, std::nano>(key_end - mid).count();
+    delta_ns += std::chrono::duration<double, std::nano>(end - key_end).count();
+    json_bytes += json->size();
+    key_bytes += key.data->size();
+    delta_bytes += delta.data->size();
+    ++measured;
+  }
+  const double n = static_cast<double>(measured);
+  std::printf("%5d %10.0f %8.0f %10.0f %8.0f %10.0f %8.0f\n", count,
+              static_cast<double>(json_bytes) / n, json_ns / n,
+              static_cast<double>(key_bytes) / n, key_ns / n,
+              static_cast<double>(delta_bytes) / n, delta_ns / n);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const long iterations = argc > 1 ? std::atol(argv[1]) : 200000;
+  const FrameSize frame_size{640, 480};
+  bool identical = true;
+
+  std::printf("%-14s %7s %10s %8s %12s\n", "serializer", "dets", "ns/frame", "bytes",
+              "allocs/frame");
+  for (int count : {1, 4, 30}) {
+    const Detections detections = make_detections(count);
+    JsonWriter json;
+    write_frame_meta_json(json, 42, detections, frame_size);
+    if (json.str() != legacy_frame_meta_to_json(42, detections, frame_size)) {
+      std::fprintf(stderr, "output differs at %d detections:\n  %s\n  %s\n", count,
+                   json.str().c_str(), legacy_frame_meta_to_json(42, detections, frame_size).c_str());
+      identical = false;
+    }
+
+    measure("ostringstream", count, iterations, [&](uint64_t sequence) {
+      return legacy_frame_meta_to_json(sequence, detections, frame_size).size();
+    });
+    measure("JsonWriter", count, iterations, [&](uint64_t sequence) {
+      write_frame_meta_json(json, sequence, detections, frame_size);
+      return json.str().size();
+    });
+  }
+
+  // 1e15以上はprintfを通さず整数で書く（ロケールの小数点に左右されない）
+  const std::pair<double, const char *> large[] = {
+      {1e15, "1000000000000000"}, {-2.5e16, "-25000000000000000"},
+      {1e300, "18446744073709551615"}};
+  for (const auto &[number, expected] : large) {
+    JsonWriter json;
+    json.value(number);
+    if (json.str() != expected) {
+      std::fprintf(stderr, "value(%g) wrote %s, expected %s\n", number, json.str().c_str(),
+                   expected);
+      identical = false;
+    }
+  }
+
+  // 版ごとのエンコード（DetectionStoreの追跡ログは捨てる）
+  std::cout.setstate(std::ios::failbit);
+  std::printf("\n%5s %10s %8s %10s %8s %10s %8s\n", "dets", "json B", "json ns", "key B",
+              "key ns", "delta B", "delta ns");
+  for (int count : {1, 4, 30}) {
+    compare_encodings(count, iterations / 10);
+  }
+  return identical ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+// /api/detections の条件付きGETと長ポーリングのループバック試験。
+//   ./long_poll_test
+// HttpServer（worker_loop / resume_waiting）とserve_api_client（api_unchanged_since）を
+// 本物のソケット越しに動かし、次を確認する:
+//   ?since=<現在の版> と If-None-Match は304、別プロセス（別epoch）のETagは一致しない、
+//   ?wait=1 はupdate()で起きて新しい版を返す、何も変わらなければlong_poll_sec後に304、
+//   JSONとバイナリで本文が変わるので応答にはVary: Acceptが付く。
+// どれかが想定どおりでなければ終了コード1
+#include "app_under_test.h"
+
+#include <cstdio>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kLongPollSec = 1;
+
+bool g_ok = true;
+
+void expect(bool condition, const char *what) {
+  std::printf("%-56s %s\n", what, condition ? "ok" : "FAILED");
+  g_ok &= condition;
+}
+
+struct Reply {
+  int status = 0;
+  std::string etag;
+  std::string vary;
+  std::string body;
+  double ms = 0.0;
+};
+
+// 1リクエスト1接続（Connection: close）で応答を最後まで読む
+Reply http_get(uint16_t port, const std::string &target, const std::string &headers = "") {
+  Reply reply;
+  const auto start = Clock::now();
+  const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in addr {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    std::perror("connect");
+    std::exit(1);
+  }
+  const std::string request = "GET " + target + " HTTP/1.1\r\nHost: test\r\n" + headers +
+                              "Connection: close\r\n\r\n";
+  send_all(fd, request.data(), request.size());
+  std::string data;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = ::recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    data.append(buffer, static_cast<size_t>(n));
+  }
+  ::close(fd);
+  reply.ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  const size_t header_end = data.find("\r\n\r\n");
+  if (data.size() < 12 || header_end == std::string::npos) {
+    return reply;
+  }
+  reply.status = std::atoi(data.c_str() + 9);
+  const size_t etag = data.find("ETag: ");
+  if (etag < header_end) {
+    reply.etag = data.substr(etag + 6, data.find("\r\n", etag) - etag - 6);
+  }
+  const size_t vary = data.find("Vary: ");
+  if (vary < header_end) {
+    reply.vary = data.substr(vary + 6, data.find("\r\n", vary) - vary - 6);
+  }
+  reply.body = data.substr(header_end + 4);
+  return reply;
+}
+
+std::vector<Detection> make_frame(int frame) {
+  Detection det{};
+  det.tracking_id = 1;
+  det.confidence = 0.9f;
+  det.left = 100.0f + static_cast<float>(frame);
+  det.top = 80.0f;
+  det.width = 80.0f;
+  det.height = 220.0f;
+  return {det};
+}
+
+}  // namespace
+
+int main() {
+  std::cout.setstate(std::ios::failbit);  // 追跡のログを捨てる
+
+  DetectionStore store;
+  DetectionJsonCache detection_json(store);
+  DetectionBinaryCache detection_binary(store);
+  DetectionRing detection_ring;
+  ClipRecorder clip_recorder(ClipRecorder::Config{});
+  ClipSender clip_sender;
+
+  HttpServer::Config config;
+  config.workers = 2;
+  config.long_poll_sec = kLongPollSec;
+  HttpServer server(config);
+  const int server_fd = create_server_socket(0);
+  sockaddr_in bound {};
+  socklen_t len = sizeof(bound);
+  ::getsockname(server_fd, reinterpret_cast<sockaddr *>(&bound), &len);
+  const uint16_t port = ntohs(bound.sin_port);
+  const bool started = server.start(server_fd, [&](int client, const HttpRequest &request) {
+    return serve_api_client(client, request, store, detection_json, detection_binary,
+                            detection_ring, clip_recorder, clip_sender, server);
+  });
+  if (!started) {
+    return 1;
+  }
+  store.set_version_listener([&server]() { server.notify_waiters(); });
+
+  int frame = 0;
+  store.update(make_frame(frame++), FrameSize{640, 480});
+  const std::string version = std::to_string(store.snapshot()->version);
+
+  const Reply first = http_get(port, "/api/detections");
+  expect(first.status == 200 && !first.etag.empty(), "plain GET is 200 with an ETag");
+  const Reply binary = http_get(port, "/api/detections",
+                                std::string("Accept: ") + DetectionBinaryCache::kContentType + "\r\n");
+  expect(first.vary == "Accept" && binary.vary == "Accept",
+         "JSON and binary responses both carry Vary: Accept");
+
+  const Reply since = http_get(port, "/api/detections?since=" + version);
+  expect(since.status == 304 && since.body.empty(), "?since=<current version> is 304, no body");
+  expect(since.vary == "Accept", "304 carries Vary: Accept too");
+
+  const Reply older = http_get(port, "/api/detections?since=0");
+  expect(older.status == 200, "?since=<older version> is 200");
+
+  const Reply matched = http_get(port, "/api/detections", "If-None-Match: " + first.etag + "\r\n");
+  expect(matched.status == 304 && matched.body.empty(), "If-None-Match with the ETag is 304");
+
+  // 別プロセスのETag: 版は同じでもepochが違う（"d<epoch>.<版>"）
+  std::string foreign = first.etag;
+  foreign[2] = foreign[2] == '0' ? '1' : '0';
+  const Reply other = http_get(port, "/api/detections", "If-None-Match: " + foreign + "\r\n");
+  expect(other.status == 200, "ETag from another process epoch does not match");
+
+  // 長ポーリング: 保留中にupdate()で版が進むと、その場で新しい版が返る
+  Reply woken;
+  std::thread waiter([&]() {
+    woken = http_get(port, "/api/detections?since=" + version + "&wait=1");
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  store.update(make_frame(frame++), FrameSize{640, 480});
+  waiter.join();
+  const std::string next = "\"version\":" + std::to_string(store.snapshot()->version);
+  std::printf("wait=1 woken by update() after %.0f ms\n", woken.ms);
+  expect(woken.status == 200 && woken.body.find(next) != std::string::npos,
+         "wait=1 wakes on update() with the new version");
+  expect(woken.ms >= 150.0 && woken.ms < 1000.0 * kLongPollSec,
+         "wait=1 was held until the update, not until the timeout");
+
+  // 何も変わらなければlong_poll_sec後に304
+  const std::string current = std::to_string(store.snapshot()->version);
+  const Reply expired = http_get(port, "/api/detections?since=" + current + "&wait=1");
+  std::printf("wait=1 without changes answered after %.0f ms\n", expired.ms);
+  expect(expired.status == 304 && expired.body.empty(), "wait=1 times out with 304");
+  expect(expired.ms >= 900.0 * kLongPollSec && expired.ms < 3000.0 * kLongPollSec,
+         "wait=1 times out after about long_poll_sec");
+
+  store.set_version_listener(nullptr);
+  server.stop();
+  ::close(server_fd);
+  return g_ok ? 0 : 1;
+}
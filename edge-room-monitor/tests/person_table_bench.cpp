@@ -0,0 +1,99 @@
+// 人数ごとのDetectionStore::update()とPersonTable::find()のベンチマーク（1スレッド）。
+//   ./person_table_bench [iterations]
+// APP_MAX_PERSONS相当の上限を4・32・128にし、その人数が毎フレーム少しずつ動く。
+// どの上限もkMaxPersonsLimitより小さいので丸められず、128人でも全員に固定IDが付く。
+// 上限や追跡人数が想定どおりでなければ終了コード1
+#include "app_under_test.h"
+
+#include <cstdio>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+volatile int g_sink;  // find()の結果を最適化で消されないように
+
+std::vector<Detection> make_people(int count) {
+  std::vector<Detection> detections;
+  for (int i = 0; i < count; ++i) {
+    Detection det{};
+    det.tracking_id = 5000 + static_cast<uint64_t>(i);
+    det.confidence = 0.8f;
+    det.left = static_cast<float>((i * 37) % 560);
+    det.top = static_cast<float>(40 + (i * 13) % 200);
+    det.width = 80.0f;
+    det.height = 220.0f;
+    detections.push_back(det);
+  }
+  return detections;
+}
+
+bool run(int requested, long iterations) {
+  DetectionStore store(requested);
+  const int capacity = store.max_persons();
+  const int expected = std::max(1, std::min(DetectionStore::kMaxPersonsLimit, requested));
+  std::vector<Detection> detections = make_people(requested);
+  const std::vector<Detection> origin = detections;
+
+  auto move = [&](long frame) {
+    for (size_t k = 0; k < detections.size(); ++k) {
+      detections[k].left = origin[k].left + static_cast<float>(frame % 6);
+    }
+  };
+  for (long frame = 0; frame < 30; ++frame) {  // 自動登録を済ませる
+    move(frame);
+    store.update(detections, FrameSize{640, 480});
+  }
+
+  const auto start = Clock::now();
+  for (long frame = 0; frame < iterations; ++frame) {
+    move(frame);
+    store.update(detections, FrameSize{640, 480});
+  }
+  const double update_ns =
+      std::chrono::duration<double, std::nano>(Clock::now() - start).count() /
+      static_cast<double>(iterations);
+
+  int tracked = 0;
+  for (const auto &entry : store.snapshot()->detections) {
+    tracked += entry.fixed_id >= 0;
+  }
+
+  // 索引だけの引き（追跡中・未登録のIDを半々に）
+  PersonTable table(capacity);
+  for (int i = 0; i < capacity; ++i) {
+    table.acquire(5000 + static_cast<uint64_t>(i));
+  }
+  const long lookups = iterations * 64;
+  int found = 0;
+  const auto find_start = Clock::now();
+  for (long i = 0; i < lookups; ++i) {
+    found += table.find(5000 + static_cast<uint64_t>(i % (2 * capacity))) >= 0;
+  }
+  const double find_ns =
+      std::chrono::duration<double, std::nano>(Clock::now() - find_start).count() /
+      static_cast<double>(lookups);
+  g_sink = found;
+
+  std::printf("%9d %8d %7d %7d %10.0f %8.1f %8.1f%s\n", requested, capacity,
+              requested, tracked, update_ns, update_ns / requested, find_ns,
+              capacity != requested ? "  <- clamped to kMaxPersonsLimit" : "");
+  return capacity == expected && tracked == std::min(requested, capacity);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const long iterations = argc > 1 ? std::atol(argv[1]) : 20000;
+
+  std::cout.setstate(std::ios::failbit);  // 自動登録のログを捨てる
+  std::printf("kMaxPersonsLimit=%d, %ld frames per row\n", DetectionStore::kMaxPersonsLimit,
+              iterations);
+  std::printf("%9s %8s %7s %7s %10s %8s %8s\n", "requested", "capacity", "dets", "tracked",
+              "update ns", "ns/det", "find ns");
+  bool ok = true;
+  for (int requested : {4, 32, 128}) {
+    ok &= run(requested, iterations);
+  }
+  return ok ? 0 : 1;
+}
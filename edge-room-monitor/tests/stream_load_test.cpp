@@ -0,0 +1,250 @@
+// /stream（MjpegStreamer）の負荷試験。
+//   ./stream_load_test [seconds] [frame_bytes]
+// 30fpsで偽のJPEGをFrameStoreへ流し、ループバックTCPで1・10・100クライアントに配信する。
+// 最後の行では読まない（詰まった）クライアントを3つ混ぜ、他のクライアントが遅れないことを見る。
+// クライアントごとの受信fps（最小・平均）、合計スループット、配信側のCPU使用率と、
+// フレームを作ってから受信し終わるまでの遅延（p50/p99/最大）を表示する。
+// 受信0フレームのクライアントがあるか、詰まったクライアントがいる行で読む側の遅延のp99が
+// kStalledLatencyLimitMsを超えたら終了コード1
+#include "app_under_test.h"
+#include "gst_stub.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr double kFps = 30.0;
+constexpr double kStalledLatencyLimitMs = 100.0;
+
+// 偽JPEGの末尾に書く送信時刻（steady_clockのns）。"@ts=" + 20桁 + ";"
+constexpr std::string_view kStampPrefix = "@ts=";
+constexpr size_t kStampBytes = 25;
+
+uint64_t now_ns() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now().time_since_epoch()).count());
+}
+
+double percentile_ms(std::vector<double> &samples, double p) {
+  if (samples.empty()) {
+    return 0.0;
+  }
+  std::sort(samples.begin(), samples.end());
+  const size_t index = std::min(samples.size() - 1,
+                                static_cast<size_t>(p * static_cast<double>(samples.size())));
+  return samples[index];
+}
+
+double thread_cpu_seconds() {
+  timespec ts {};
+  ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+double process_cpu_seconds() {
+  rusage usage {};
+  ::getrusage(RUSAGE_SELF, &usage);
+  return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+         static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// 127.0.0.1の空きポートで待ち受ける
+int listen_loopback(sockaddr_in &addr) {
+  const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  addr = sockaddr_in {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, 256) != 0 ||
+      ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+    std::perror("listen");
+    std::exit(1);
+  }
+  return fd;
+}
+
+// クライアント側の受信状態。境界 "--frame\r\n" と送信時刻が読み込みの切れ目をまたいでも
+// 読めるよう、直前の読み込みの末尾を残しておく
+struct Reader {
+  int fd = -1;
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  std::string tail;
+};
+
+// 前回の読み込みの末尾（tail）だけに収まる一致は数え済みなので、tailより先に
+// はみ出すものだけを数える。送信時刻はフレームの末尾にあるので、読めた時点で受信し終わっている
+void count_frames(Reader &reader, const char *data, size_t size, std::vector<double> &latency_ms) {
+  static const std::string_view kBoundary = "--frame\r\n";
+  const uint64_t received = now_ns();
+  const size_t seen = reader.tail.size();
+  std::string window = reader.tail;
+  window.append(data, size);
+  size_t pos = 0;
+  while ((pos = window.find(kBoundary, pos)) != std::string::npos) {
+    if (pos + kBoundary.size() > seen) {
+      ++reader.frames;
+    }
+    pos += kBoundary.size();
+  }
+  pos = 0;
+  while ((pos = window.find(kStampPrefix, pos)) != std::string::npos &&
+         pos + kStampBytes <= window.size()) {
+    if (pos + kStampBytes > seen) {
+      const uint64_t sent = std::strtoull(window.c_str() + pos + kStampPrefix.size(), nullptr, 10);
+      latency_ms.push_back(static_cast<double>(received - sent) / 1e6);
+    }
+    pos += kStampBytes;
+  }
+  const size_t keep = std::min(window.size(), kStampBytes - 1);
+  reader.tail.assign(window, window.size() - keep, keep);
+}
+
+// 30fpsでフレームを作ってFrameStoreへ渡す（カメラの代わり）
+void produce(FrameStore &store, size_t frame_bytes, std::atomic<bool> &running,
+             double &cpu_seconds) {
+  const double cpu_start = thread_cpu_seconds();
+  const auto period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / kFps));
+  auto next = Clock::now();
+  unsigned char fill = 0;
+  while (running.load()) {
+    GstBuffer *buffer = make_stub_buffer(frame_bytes, static_cast<unsigned char>(0x80 | fill++));
+    GstMapInfo map;
+    gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+    char stamp[kStampBytes + 1];
+    std::snprintf(stamp, sizeof(stamp), "@ts=%020llu;", static_cast<unsigned long long>(now_ns()));
+    std::memcpy(map.data + map.size - kStampBytes, stamp, kStampBytes);
+    gst_buffer_unmap(buffer, &map);
+    store.update(JpegFrame::wrap(buffer));
+    gst_buffer_unref(buffer);
+    next += period;
+    std::this_thread::sleep_until(next);
+  }
+  cpu_seconds = thread_cpu_seconds() - cpu_start;
+}
+
+bool run(int clients, int stalled, double seconds, size_t frame_bytes) {
+  FrameStore store;
+  MjpegStreamer streamer(store);
+  if (!streamer.start()) {
+    return false;
+  }
+  sockaddr_in addr {};
+  const int listen_fd = listen_loopback(addr);
+  std::vector<Reader> readers(static_cast<size_t>(clients));
+  std::vector<int> stalled_fds;
+  for (int i = 0; i < clients + stalled; ++i) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+      std::perror("connect");
+      std::exit(1);
+    }
+    const int server_fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    streamer.add_client(server_fd, false);
+    if (i < clients) {
+      readers[static_cast<size_t>(i)].fd = fd;
+    } else {
+      stalled_fds.push_back(fd);
+    }
+  }
+  ::close(listen_fd);
+
+  std::atomic<bool> running{true};
+  double producer_cpu = 0.0;
+  std::thread producer([&]() { produce(store, frame_bytes, running, producer_cpu); });
+  const double cpu_start = process_cpu_seconds();
+  const double reader_cpu_start = thread_cpu_seconds();
+
+  // すべての読むクライアントを1つのepollで読む
+  const int epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+  for (size_t i = 0; i < readers.size(); ++i) {
+    epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = i;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, readers[i].fd, &ev);
+  }
+  std::vector<char> buffer(256 * 1024);
+  std::vector<double> latency_ms;
+  epoll_event events[64];
+  const auto start = Clock::now();
+  const auto deadline = start + std::chrono::duration_cast<Clock::duration>(
+                                    std::chrono::duration<double>(seconds));
+  while (Clock::now() < deadline) {
+    const int n = ::epoll_wait(epoll_fd, events, 64, 50);
+    for (int i = 0; i < n; ++i) {
+      Reader &reader = readers[events[i].data.u64];
+      const ssize_t got = ::recv(reader.fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+      if (got > 0) {
+        reader.bytes += static_cast<uint64_t>(got);
+        count_frames(reader, buffer.data(), static_cast<size_t>(got), latency_ms);
+      }
+    }
+  }
+  const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  const double reader_cpu = thread_cpu_seconds() - reader_cpu_start;
+  running = false;
+  producer.join();
+  const double process_cpu = process_cpu_seconds() - cpu_start;
+  streamer.stop();
+  ::close(epoll_fd);
+
+  double min_fps = 1e9;
+  double total_fps = 0.0;
+  uint64_t total_bytes = 0;
+  bool all_received = true;
+  for (Reader &reader : readers) {
+    // 接続直後の1フレームを除く
+    const double fps = static_cast<double>(reader.frames > 0 ? reader.frames - 1 : 0) / elapsed;
+    min_fps = std::min(min_fps, fps);
+    total_fps += fps;
+    total_bytes += reader.bytes;
+    all_received &= reader.frames > 0;
+    ::close(reader.fd);
+  }
+  for (int fd : stalled_fds) {
+    ::close(fd);
+  }
+  // 配信側 = プロセス全体 − 受信側（このスレッド）− 生産者
+  const double server_cpu = std::max(0.0, process_cpu - reader_cpu - producer_cpu);
+  const double p50 = percentile_ms(latency_ms, 0.5);
+  const double p99 = percentile_ms(latency_ms, 0.99);
+  const double max = percentile_ms(latency_ms, 1.0);
+  std::printf("%7d %7d %9.1f %9.1f %10.1f %11.1f %7.1f %7.1f %7.1f\n", clients, stalled, min_fps,
+              total_fps / static_cast<double>(clients),
+              static_cast<double>(total_bytes) / elapsed / 1e6, 100.0 * server_cpu / elapsed,
+              p50, p99, max);
+  if (stalled > 0 && p99 > kStalledLatencyLimitMs) {
+    std::fprintf(stderr, "latency p99 %.1f ms with %d stalled clients exceeds %.0f ms\n", p99,
+                 stalled, kStalledLatencyLimitMs);
+    return false;
+  }
+  return all_received;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const double seconds = argc > 1 ? std::atof(argv[1]) : 5.0;
+  const size_t frame_bytes =
+      std::max(kStampBytes, argc > 2 ? static_cast<size_t>(std::atol(argv[2])) : 40 * 1024);
+
+  std::cout.setstate(std::ios::failbit);  // 視聴者数の変化のログを捨てる
+  std::printf("%.0f fps source, %zu-byte frames, %.1f s per row, %u hardware threads\n", kFps,
+              frame_bytes, seconds, std::thread::hardware_concurrency());
+  std::printf("%7s %7s %9s %9s %10s %11s %7s %7s %7s\n", "clients", "stalled", "fps min",
+              "fps avg", "MB/s", "server CPU%", "lat p50", "lat p99", "lat max");
+  bool ok = true;
+  ok &= run(1, 0, seconds, frame_bytes);
+  ok &= run(10, 0, seconds, frame_bytes);
+  ok &= run(100, 0, seconds, frame_bytes);
+  ok &= run(10, 3, seconds, frame_bytes);
+  std::printf("(latency in ms, producer to reader)\n");
+  return ok ? 0 : 1;
+}
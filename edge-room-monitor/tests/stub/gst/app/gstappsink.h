@@ -0,0 +1,12 @@
+// Host-side stand-in for gst/app/gstappsink.h (see tests/stub/gst/gst.h)
+#pragma once
+
+#include "../gst.h"
+
+struct GstAppSink : GstElement {};
+
+#define GST_APP_SINK(x) ((GstAppSink *)(x))
+
+GstSample *gst_app_sink_try_pull_sample(GstAppSink *appsink, GstClockTime timeout);
+void gst_app_sink_set_max_buffers(GstAppSink *appsink, guint max);
+void gst_app_sink_set_drop(GstAppSink *appsink, gboolean drop);
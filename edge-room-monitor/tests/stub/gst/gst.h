@@ -0,0 +1,80 @@
+// Host-side stand-in for the parts of GStreamer 1.14 that src/main.cpp uses.
+// Declarations only; tests/stub/gst_stub.cpp provides inert implementations
+// plus a heap-backed GstBuffer so frame handling can run without a pipeline.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+typedef unsigned char guint8;
+typedef size_t gsize;
+typedef int gboolean;
+typedef char gchar;
+typedef unsigned int guint;
+typedef int gint;
+typedef uint64_t guint64;
+typedef int64_t gint64;
+typedef void *gpointer;
+typedef uint64_t GstClockTime;
+
+#define TRUE 1
+#define FALSE 0
+#define GST_SECOND ((GstClockTime)1000000000)
+#define GST_CLOCK_TIME_NONE ((GstClockTime)-1)
+
+struct GError {
+  char *message;
+};
+
+struct GstObject {};
+struct GstElement : GstObject {};
+struct GstBin : GstElement {};
+struct GstBufferPool;
+struct GstBuffer {
+  GstClockTime pts;
+  guint8 *data;
+  gsize size;
+  int refcount;
+  GstBufferPool *pool;
+};
+struct GstSample {};
+struct GstBus {};
+struct GstMessage {};
+struct GstMapInfo {
+  guint8 *data;
+  gsize size;
+};
+
+enum GstMapFlags { GST_MAP_READ = 1, GST_MAP_WRITE = 2 };
+enum GstMessageType { GST_MESSAGE_ERROR = 1, GST_MESSAGE_EOS = 2 };
+enum GstState { GST_STATE_NULL, GST_STATE_PLAYING };
+enum GstStateChangeReturn { GST_STATE_CHANGE_FAILURE, GST_STATE_CHANGE_SUCCESS };
+
+#define GST_BIN(x) ((GstBin *)(x))
+#define GST_MESSAGE_TYPE(m) ((GstMessageType)0)
+#define G_OBJECT(x) ((void *)(x))
+#define GST_BUFFER_PTS(b) ((b)->pts)
+
+void gst_init(int *argc, char ***argv);
+GstElement *gst_parse_launch(const char *description, GError **error);
+void g_error_free(GError *error);
+void g_free(void *mem);
+void g_object_set(void *object, const char *first_property_name, ...);
+
+GstElement *gst_bin_get_by_name(GstBin *bin, const char *name);
+void gst_object_unref(void *object);
+GstStateChangeReturn gst_element_set_state(GstElement *element, GstState state);
+GstBus *gst_element_get_bus(GstElement *element);
+
+GstMessage *gst_bus_timed_pop_filtered(GstBus *bus, GstClockTime timeout, GstMessageType types);
+void gst_message_parse_error(GstMessage *message, GError **gerror, gchar **debug);
+void gst_message_unref(GstMessage *message);
+
+void gst_sample_unref(GstSample *sample);
+GstBuffer *gst_sample_get_buffer(GstSample *sample);
+
+gboolean gst_buffer_map(GstBuffer *buffer, GstMapInfo *info, GstMapFlags flags);
+void gst_buffer_unmap(GstBuffer *buffer, GstMapInfo *info);
+GstBuffer *gst_buffer_ref(GstBuffer *buffer);
+void gst_buffer_unref(GstBuffer *buffer);
+GstBuffer *gst_buffer_copy_deep(const GstBuffer *buffer);
@@ -0,0 +1,66 @@
+// Inert implementations of the stubbed GStreamer/DeepStream API. No pipeline
+// ever starts; tests create frames with make_stub_buffer().
+#include "gst_stub.h"
+
+#include <gst/app/gstappsink.h>
+#include <gstnvdsmeta.h>
+
+#include <cstdlib>
+#include <cstring>
+
+GstBuffer *make_stub_buffer(size_t size, unsigned char fill) {
+  GstBuffer *buffer = new GstBuffer{};
+  buffer->data = static_cast<guint8 *>(std::malloc(size ? size : 1));
+  std::memset(buffer->data, fill, size);
+  buffer->size = size;
+  buffer->refcount = 1;
+  return buffer;
+}
+
+gboolean gst_buffer_map(GstBuffer *buffer, GstMapInfo *info, GstMapFlags) {
+  info->data = buffer->data;
+  info->size = buffer->size;
+  return TRUE;
+}
+
+void gst_buffer_unmap(GstBuffer *, GstMapInfo *) {}
+
+GstBuffer *gst_buffer_ref(GstBuffer *buffer) {
+  __atomic_add_fetch(&buffer->refcount, 1, __ATOMIC_SEQ_CST);
+  return buffer;
+}
+
+void gst_buffer_unref(GstBuffer *buffer) {
+  if (__atomic_sub_fetch(&buffer->refcount, 1, __ATOMIC_SEQ_CST) == 0) {
+    std::free(buffer->data);
+    delete buffer;
+  }
+}
+
+GstBuffer *gst_buffer_copy_deep(const GstBuffer *) { return nullptr; }
+
+void gst_init(int *, char ***) {}
+GstElement *gst_parse_launch(const char *, GError **) { return nullptr; }
+void g_error_free(GError *) {}
+void g_free(void *) {}
+void g_object_set(void *, const char *, ...) {}
+
+GstElement *gst_bin_get_by_name(GstBin *, const char *) { return nullptr; }
+void gst_object_unref(void *) {}
+GstStateChangeReturn gst_element_set_state(GstElement *, GstState) {
+  return GST_STATE_CHANGE_SUCCESS;
+}
+GstBus *gst_element_get_bus(GstElement *) { return nullptr; }
+
+GstMessage *gst_bus_timed_pop_filtered(GstBus *, GstClockTime, GstMessageType) { return nullptr; }
+void gst_message_parse_error(GstMessage *, GError **, gchar **) {}
+void gst_message_unref(GstMessage *) {}
+
+void gst_sample_unref(GstSample *) {}
+GstBuffer *gst_sample_get_buffer(GstSample *) { return nullptr; }
+
+GstSample *gst_app_sink_try_pull_sample(GstAppSink *, GstClockTime) { return nullptr; }
+void gst_app_sink_set_max_buffers(GstAppSink *, guint) {}
+void gst_app_sink_set_drop(GstAppSink *, gboolean) {}
+
+NvDsBatchMeta *gst_buffer_get_nvds_batch_meta(GstBuffer *) { return nullptr; }
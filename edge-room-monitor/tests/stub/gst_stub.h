@@ -0,0 +1,7 @@
+// Test helpers for the stubbed GStreamer API (tests/stub/gst_stub.cpp)
+#pragma once
+
+#include <gst/gst.h>
+
+// New GstBuffer with `size` bytes of `fill` and one reference
+GstBuffer *make_stub_buffer(size_t size, unsigned char fill);
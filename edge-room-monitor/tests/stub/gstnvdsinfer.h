@@ -0,0 +1,16 @@
+// Host-side stand-in for DeepStream's gstnvdsinfer.h: the tensor output meta
+// that nvinfer attaches with output-tensor-meta=1
+#pragma once
+
+#include "nvdsinfer_custom_impl.h"
+
+struct NvDsInferTensorMeta {
+  unsigned int unique_id;
+  unsigned int num_output_layers;
+  NvDsInferLayerInfo *output_layers_info;
+  void **out_buf_ptrs_host;
+  void **out_buf_ptrs_dev;
+  int gpu_id;
+  void *priv_data;
+  NvDsInferNetworkInfo network_info;
+};
@@ -0,0 +1,48 @@
+// Host-side stand-in for DeepStream's gstnvdsmeta.h: only the metadata fields
+// src/main.cpp reads
+#pragma once
+
+#include <gst/gst.h>
+
+#include <cstdint>
+
+struct NvDsMetaList {
+  void *data;
+  NvDsMetaList *next;
+};
+
+struct NvOSD_RectParams {
+  float left, top, width, height;
+};
+
+struct NvDsObjectMeta {
+  uint64_t object_id;
+  int class_id;
+  float confidence;
+  NvOSD_RectParams rect_params;
+};
+
+enum NvDsMetaType { NVDS_INVALID_META = -1, NVDSINFER_TENSOR_OUTPUT_META = 12 };
+
+struct NvDsBaseMeta {
+  NvDsMetaType meta_type;
+};
+
+struct NvDsUserMeta {
+  NvDsBaseMeta base_meta;
+  void *user_meta_data;
+};
+
+struct NvDsFrameMeta {
+  NvDsMetaList *obj_meta_list;
+  NvDsMetaList *frame_user_meta_list;
+  uint64_t buf_pts;
+  unsigned int pipeline_width;
+  unsigned int pipeline_height;
+};
+
+struct NvDsBatchMeta {
+  NvDsMetaList *frame_meta_list;
+};
+
+NvDsBatchMeta *gst_buffer_get_nvds_batch_meta(GstBuffer *buffer);
@@ -0,0 +1,1010 @@
+// Host-side benchmark for the YOLOv8 parser. The parser source is compiled
+// into this binary (against tests/stub/nvdsinfer_custom_impl.h) so its
+// per-thread scratch can be inspected; no GPU or DeepStream install is needed.
+//
+// Usage: yolov8_parser_bench [iterations]
+//        yolov8_parser_bench --dump <file>     write every fixture's detections
+//        yolov8_parser_bench --compare <file>  fail unless they match <file>
+//        yolov8_parser_bench --fp16            HALF vs FLOAT tensors, same values
+//        yolov8_parser_bench --allocations     no heap allocations after warm-up
+//        yolov8_parser_bench --batch [iters]   B = 1, 2, 4 frames, one parse per frame
+//        yolov8_parser_bench --batch-check     2-camera batch matches single-frame parses
+//        yolov8_parser_bench --tensor <file> [expected]
+//                                              parse a recorded output0 tensor; print the
+//                                              detections or fail unless they match
+//
+// Every fixture is a synthetic [84, 8400] output for a 640x640 input. People
+// are drawn the way YOLOv8 reports them: several neighbouring anchors per
+// person fire with slightly jittered boxes, which NMS then has to merge.
+//
+// The candidate sweep (10 to 5000 anchors above threshold) checks greedy NMS
+// against a brute-force reference over every candidate; the run fails if a
+// detection is lost or added.
+//
+// --dump / --compare serialize the raw detection structs of every fixture,
+// data type (FP32/FP16), tensor layout and NMS mode. ctest builds the parser with each SIMD backend
+// and with -DYOLOV8_FORCE_SCALAR and requires the outputs to be byte-for-byte
+// identical.
+//
+// --tensor reads a raw output0 tensor as written by the app with
+// APP_DUMP_TENSOR (output-tensor-meta=1): [84][N] FP32 or FP16. Without
+// [expected] it prints one line per detection and NMS mode; with it, the
+// detections must match that file (coordinates within 0.01 px, confidences
+// within 1e-4), so the parser is checked against stored results rather than
+// against another build of itself.
+#include "yolov8_parser.cpp"
+
+#include <cstdio>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+
+// Counts every heap allocation made by the process
+static std::atomic<uint64_t> gAllocations{0};
+
+void* operator new(std::size_t size) {
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+constexpr unsigned kNetWidth = 640;
+constexpr unsigned kNetHeight = 640;
+constexpr int kNumClasses = 80;
+constexpr int kNumAttrs = 4 + kNumClasses;
+
+// xorshift32: deterministic across compilers and standard libraries
+struct Rng {
+    uint32_t state;
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    float uniform(float lo, float hi) {
+        return lo + (hi - lo) * static_cast<float>(next() >> 8) / 16777216.0f;
+    }
+};
+
+struct Person {
+    float cx, cy, w, h;  // normalized
+    float score;
+};
+
+struct Fixture {
+    std::string name;
+    int numAnchors = 0;
+    std::vector<float> tensor;  // AttrMajor [kNumAttrs][numAnchors]
+};
+
+// Anchor centre (normalized) and stride, in YOLOv8 output order
+static void anchor_geometry(int index, float& cx, float& cy, float& stride) {
+    for (const unsigned s : {8u, 16u, 32u}) {
+        const int cols = static_cast<int>(kNetWidth / s);
+        const int cells = cols * static_cast<int>(kNetHeight / s);
+        if (index < cells) {
+            cx = ((index % cols) + 0.5f) * s / kNetWidth;
+            cy = ((index / cols) + 0.5f) * s / kNetHeight;
+            stride = static_cast<float>(s);
+            return;
+        }
+        index -= cells;
+    }
+    cx = cy = stride = 0.0f;
+}
+
+static Fixture make_background(const std::string& name, Rng& rng) {
+    Fixture f;
+    f.name = name;
+    f.numAnchors = expected_anchors(kNetWidth, kNetHeight);
+    f.tensor.resize(static_cast<size_t>(kNumAttrs) * f.numAnchors);
+    float* t = f.tensor.data();
+    const size_t n = static_cast<size_t>(f.numAnchors);
+    for (int i = 0; i < f.numAnchors; ++i) {
+        float cx, cy, stride;
+        anchor_geometry(i, cx, cy, stride);
+        t[0 * n + i] = cx;
+        t[1 * n + i] = cy;
+        t[2 * n + i] = stride * 2.0f / kNetWidth;
+        t[3 * n + i] = stride * 2.0f / kNetHeight;
+        for (int c = 0; c < kNumClasses; ++c) {
+            t[(4 + c) * n + i] = rng.uniform(0.0f, 0.05f);
+        }
+    }
+    return f;
+}
+
+// Anchors whose centre lies in the middle of a person's box report it
+static void draw_person(Fixture& f, const Person& p, Rng& rng) {
+    float* t = f.tensor.data();
+    const size_t n = static_cast<size_t>(f.numAnchors);
+    for (int i = 0; i < f.numAnchors; ++i) {
+        float cx, cy, stride;
+        anchor_geometry(i, cx, cy, stride);
+        const float dx = std::fabs(cx - p.cx) / (p.w * 0.5f);
+        const float dy = std::fabs(cy - p.cy) / (p.h * 0.5f);
+        if (dx > 0.5f || dy > 0.5f) continue;
+        // Only the stride whose scale matches the person fires strongly
+        const float scale = std::max(p.w * kNetWidth, p.h * kNetHeight) / (stride * 8.0f);
+        if (scale < 0.5f || scale > 4.0f) continue;
+        const float score = p.score * (1.0f - 0.4f * std::max(dx, dy)) * rng.uniform(0.9f, 1.0f);
+        if (score <= t[4 * n + i]) continue;
+        t[0 * n + i] = p.cx + rng.uniform(-0.01f, 0.01f) * p.w;
+        t[1 * n + i] = p.cy + rng.uniform(-0.01f, 0.01f) * p.h;
+        t[2 * n + i] = p.w * rng.uniform(0.95f, 1.05f);
+        t[3 * n + i] = p.h * rng.uniform(0.95f, 1.05f);
+        t[(4 + kPersonClassId) * n + i] = score;
+    }
+}
+
+static Fixture make_people(const std::string& name, int count, uint32_t seed) {
+    Rng rng{seed};
+    Fixture f = make_background(name, rng);
+    for (int k = 0; k < count; ++k) {
+        Person p;
+        p.w = rng.uniform(0.06f, 0.25f);
+        p.h = rng.uniform(0.15f, 0.6f);
+        p.cx = rng.uniform(p.w * 0.5f, 1.0f - p.w * 0.5f);
+        p.cy = rng.uniform(p.h * 0.5f, 1.0f - p.h * 0.5f);
+        p.score = rng.uniform(0.6f, 0.95f);
+        draw_person(f, p, rng);
+    }
+    return f;
+}
+
+// Worst case: every anchor's person score is above the threshold, with boxes
+// of all sizes scattered over the frame
+static Fixture make_adversarial(uint32_t seed) {
+    Rng rng{seed};
+    Fixture f = make_background("adversarial", rng);
+    float* t = f.tensor.data();
+    const size_t n = static_cast<size_t>(f.numAnchors);
+    for (int i = 0; i < f.numAnchors; ++i) {
+        t[0 * n + i] = rng.uniform(0.0f, 1.0f);
+        t[1 * n + i] = rng.uniform(0.0f, 1.0f);
+        t[2 * n + i] = rng.uniform(0.02f, 0.3f);
+        t[3 * n + i] = rng.uniform(0.05f, 0.6f);
+        t[(4 + kPersonClassId) * n + i] = rng.uniform(kDefaultConfThreshold, 1.0f);
+    }
+    return f;
+}
+
+// `count` anchors above threshold with distinct scores and random boxes
+static Fixture make_sweep(int count, uint32_t seed) {
+    Rng rng{seed};
+    Fixture f = make_background("sweep " + std::to_string(count), rng);
+    float* t = f.tensor.data();
+    const size_t n = static_cast<size_t>(f.numAnchors);
+    std::vector<int> order(f.numAnchors);
+    for (int i = 0; i < f.numAnchors; ++i) order[i] = i;
+    for (int i = f.numAnchors - 1; i > 0; --i) {
+        std::swap(order[i], order[rng.next() % static_cast<uint32_t>(i + 1)]);
+    }
+    for (int k = 0; k < count; ++k) {
+        const int i = order[k];
+        t[0 * n + i] = rng.uniform(0.0f, 1.0f);
+        t[1 * n + i] = rng.uniform(0.0f, 1.0f);
+        t[2 * n + i] = rng.uniform(0.02f, 0.3f);
+        t[3 * n + i] = rng.uniform(0.05f, 0.6f);
+        t[(4 + kPersonClassId) * n + i] =
+            kDefaultConfThreshold + (1.0f - kDefaultConfThreshold) * (k + 1) / (count + 1);
+    }
+    return f;
+}
+
+// Greedy NMS over every person candidate, O(n^2), as the parser did before
+// grid binning and top-K existed. Decode matches decode_anchor.
+static size_t reference_nms_count(const Fixture& f, float iouThreshold) {
+    std::vector<NvDsInferParseObjectInfo> boxes;
+    for (int i = 0; i < f.numAnchors; ++i) {
+        const float score = tensor_at<Layout::AttrMajor, float>(
+            f.tensor.data(), kNumAttrs, f.numAnchors, 4 + kPersonClassId, i);
+        if (score < kDefaultConfThreshold) continue;
+        decode_anchor<Layout::AttrMajor, float>(f.tensor.data(), kNumAttrs, f.numAnchors, i,
+                                                kPersonClassId, score,
+                                                NvDsInferNetworkInfo{kNetWidth, kNetHeight, 3},
+                                                boxes);
+    }
+    std::sort(boxes.begin(), boxes.end(), by_confidence);
+    std::vector<NvDsInferParseObjectInfo> kept;
+    for (const auto& b : boxes) {
+        bool suppressed = false;
+        for (const auto& k : kept) {
+            if (compute_iou(k, b) > iouThreshold) {
+                suppressed = true;
+                break;
+            }
+        }
+        if (!suppressed) kept.push_back(b);
+    }
+    return kept.size();
+}
+
+static std::vector<Fixture> make_fixtures() {
+    std::vector<Fixture> fixtures;
+    Rng rng{1};
+    fixtures.push_back(make_background("empty", rng));
+    fixtures.push_back(make_people("1 person", 1, 2));
+    fixtures.push_back(make_people("4 persons", 4, 3));
+    fixtures.push_back(make_people("crowded", 40, 4));
+    fixtures.push_back(make_adversarial(5));
+    return fixtures;
+}
+
+// Same thresholds as configs/yolov8n_infer_config.txt: person only, 0.4
+static NvDsInferParseDetectionParams person_params() {
+    NvDsInferParseDetectionParams params;
+    params.numClassesConfigured = kNumClasses;
+    params.perClassPreclusterThreshold.assign(kNumClasses, 1.1f);
+    params.perClassPreclusterThreshold[kPersonClassId] = kDefaultConfThreshold;
+    return params;
+}
+
+// Round-to-nearest-even float -> IEEE 754 binary16, as TensorRT writes FP16
+// outputs. Fixture values are finite and well inside the half range.
+static Half to_half(float value) {
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    const uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000u);
+    x &= 0x7fffffffu;
+    if (x >= 0x47800000u) {
+        return Half{static_cast<uint16_t>(sign | 0x7c00u)};  // overflow -> inf
+    }
+    if (x < 0x38800000u) {
+        // Subnormal half: units of 2^-24, nearbyint rounds to even
+        float magnitude;
+        std::memcpy(&magnitude, &x, sizeof(magnitude));
+        return Half{static_cast<uint16_t>(sign | static_cast<uint16_t>(
+            std::nearbyint(magnitude * 16777216.0f)))};
+    }
+    uint32_t h = (((x >> 23) - 112u) << 10) | ((x & 0x7fffffu) >> 13);
+    const uint32_t rest = x & 0x1fffu;
+    if (rest > 0x1000u || (rest == 0x1000u && (h & 1u))) {
+        ++h;  // may carry into the exponent, which is still correct
+    }
+    return Half{static_cast<uint16_t>(sign | h)};
+}
+
+// One fixture as an nvinfer output layer: FLOAT or HALF, in the [84, 8400]
+// (AttrMajor) or transposed [8400, 84] (AnchorMajor) layout
+struct Tensor {
+    std::vector<float> f32;
+    std::vector<Half> f16;
+    std::vector<NvDsInferLayerInfo> layers;
+};
+
+static void make_tensor(const Fixture& f, NvDsInferDataType dataType, bool anchorMajor,
+                        Tensor& out) {
+    const size_t n = f.tensor.size();
+    out.f32.resize(n);
+    for (int a = 0; a < kNumAttrs; ++a) {
+        for (int i = 0; i < f.numAnchors; ++i) {
+            const size_t src = static_cast<size_t>(a) * f.numAnchors + i;
+            const size_t dst = anchorMajor ? static_cast<size_t>(i) * kNumAttrs + a : src;
+            out.f32[dst] = f.tensor[src];
+        }
+    }
+    out.f16.clear();
+    if (dataType == HALF) {
+        out.f16.reserve(n);
+        for (const float v : out.f32) {
+            out.f16.push_back(to_half(v));
+        }
+    }
+
+    NvDsInferLayerInfo layer{};
+    layer.dataType = dataType;
+    layer.inferDims.numDims = 2;
+    layer.inferDims.d[0] = anchorMajor ? static_cast<unsigned>(f.numAnchors) : kNumAttrs;
+    layer.inferDims.d[1] = anchorMajor ? kNumAttrs : static_cast<unsigned>(f.numAnchors);
+    layer.inferDims.numElements = layer.inferDims.d[0] * layer.inferDims.d[1];
+    layer.layerName = "output0";
+    layer.buffer = dataType == HALF ? static_cast<void*>(out.f16.data())
+                                    : static_cast<void*>(out.f32.data());
+    out.layers.assign(1, layer);
+}
+
+// FLOAT tensor holding exactly the values of a HALF tensor
+static void widen_tensor(const Tensor& half, Tensor& out) {
+    out.f16.clear();
+    out.f32.resize(half.f16.size());
+    for (size_t i = 0; i < half.f16.size(); ++i) {
+        out.f32[i] = to_float(half.f16[i]);
+    }
+    out.layers = half.layers;
+    out.layers[0].dataType = FLOAT;
+    out.layers[0].buffer = out.f32.data();
+}
+
+struct ModeEntry {
+    const char* name;
+    NvDsInferParseCustomFunc fn;
+};
+
+const ModeEntry kModes[] = {
+    {"hard", &NvDsInferParseYoloV8},
+    {"soft", &NvDsInferParseYoloV8SoftNms},
+    {"cluster", &NvDsInferParseYoloV8ClusterNms},
+};
+
+static std::vector<Fixture> make_sweep_fixtures() {
+    std::vector<Fixture> fixtures;
+    for (const int count : {10, 50, 100, 500, 1000, 2000, 3000, 5000}) {
+        fixtures.push_back(make_sweep(count, 100 + count));
+    }
+    return fixtures;
+}
+
+static bool run_benchmark(int iterations) {
+    const int warmup = 3;
+    const std::vector<Fixture> fixtures = make_fixtures();
+    const NvDsInferNetworkInfo network{kNetWidth, kNetHeight, 3};
+    const NvDsInferParseDetectionParams params = person_params();
+
+    std::printf("%-12s %-5s %-8s %10s %10s %8s %12s\n",
+                "fixture", "type", "nms", "ns/frame", "candidates", "objects", "allocs/frame");
+    bool ok = true;
+    Tensor tensor;
+    for (const Fixture& f : fixtures) {
+        for (const NvDsInferDataType dataType : {FLOAT, HALF}) {
+            make_tensor(f, dataType, false, tensor);
+            for (const ModeEntry& mode : kModes) {
+                std::vector<NvDsInferParseObjectInfo> objects;
+                for (int i = 0; i < warmup; ++i) {
+                    objects.clear();
+                    ok &= mode.fn(tensor.layers, network, params, objects);
+                }
+
+                const uint64_t allocsBefore = gAllocations.load();
+                const auto start = std::chrono::steady_clock::now();
+                for (int i = 0; i < iterations; ++i) {
+                    objects.clear();
+                    ok &= mode.fn(tensor.layers, network, params, objects);
+                }
+                const auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+                const uint64_t allocs = gAllocations.load() - allocsBefore;
+
+                std::printf("%-12s %-5s %-8s %10lld %10zu %8zu %12.2f\n",
+                            f.name.c_str(), dataType == HALF ? "fp16" : "fp32", mode.name,
+                            static_cast<long long>(nanos / iterations),
+                            parse_scratch().candidates.size(), objects.size(),
+                            static_cast<double>(allocs) / iterations);
+            }
+        }
+    }
+
+    std::printf("\n%-12s %10s %10s %8s %10s %12s\n",
+                "sweep", "ns/frame", "candidates", "objects", "reference", "allocs/frame");
+    for (const Fixture& f : make_sweep_fixtures()) {
+        make_tensor(f, FLOAT, false, tensor);
+        std::vector<NvDsInferParseObjectInfo> objects;
+        for (int i = 0; i < warmup; ++i) {
+            objects.clear();
+            ok &= NvDsInferParseYoloV8(tensor.layers, network, params, objects);
+        }
+        const uint64_t allocsBefore = gAllocations.load();
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            objects.clear();
+            ok &= NvDsInferParseYoloV8(tensor.layers, network, params, objects);
+        }
+        const auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        const uint64_t allocs = gAllocations.load() - allocsBefore;
+        const size_t reference = reference_nms_count(f, nms_iou_threshold());
+
+        std::printf("%-12s %10lld %10zu %8zu %10zu %12.2f\n",
+                    f.name.c_str(), static_cast<long long>(nanos / iterations),
+                    parse_scratch().candidates.size(), objects.size(), reference,
+                    static_cast<double>(allocs) / iterations);
+        if (nms_top_k() == 0 && objects.size() != reference) {
+            std::fprintf(stderr, "%s: NMS kept %zu detections, reference kept %zu\n",
+                         f.name.c_str(), objects.size(), reference);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static std::vector<Fixture> make_all_fixtures() {
+    std::vector<Fixture> fixtures = make_fixtures();
+    for (Fixture& f : make_sweep_fixtures()) {
+        fixtures.push_back(std::move(f));
+    }
+    return fixtures;
+}
+
+static const char* layout_name(bool anchorMajor) {
+    return anchorMajor ? "anchor-major" : "attr-major";
+}
+
+// Detections of every fixture x data type x layout x NMS mode, as raw struct
+// bytes. Each record is "<fixture>/<type>/<layout>/<mode>\0", a uint32 count,
+// then the objects.
+static bool dump_outputs(std::string& out) {
+    const NvDsInferNetworkInfo network{kNetWidth, kNetHeight, 3};
+    const NvDsInferParseDetectionParams params = person_params();
+
+    bool ok = true;
+    Tensor tensor;
+    for (const Fixture& f : make_all_fixtures()) {
+        for (const NvDsInferDataType dataType : {FLOAT, HALF}) {
+            for (const bool anchorMajor : {false, true}) {
+                make_tensor(f, dataType, anchorMajor, tensor);
+                for (const ModeEntry& mode : kModes) {
+                    std::vector<NvDsInferParseObjectInfo> objects;
+                    ok &= mode.fn(tensor.layers, network, params, objects);
+                    out += f.name + (dataType == HALF ? "/fp16/" : "/fp32/") +
+                           layout_name(anchorMajor) + "/" + mode.name;
+                    out += '\0';
+                    const uint32_t count = static_cast<uint32_t>(objects.size());
+                    out.append(reinterpret_cast<const char*>(&count), sizeof(count));
+                    out.append(reinterpret_cast<const char*>(objects.data()),
+                               objects.size() * sizeof(NvDsInferParseObjectInfo));
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+// A HALF tensor must parse exactly like a FLOAT tensor holding the same
+// (widened) values: FP16 support may only change how scores are loaded.
+// Detection counts against the original FP32 fixture are printed for
+// reference; they can differ slightly where rounding crosses the threshold.
+static bool check_fp16() {
+    const NvDsInferNetworkInfo network{kNetWidth, kNetHeight, 3};
+    const NvDsInferParseDetectionParams params = person_params();
+
+    bool ok = true;
+    Tensor original, half, widened;
+    std::printf("%-12s %-12s %-8s %8s %8s\n", "fixture", "layout", "nms", "fp32", "fp16");
+    for (const Fixture& f : make_all_fixtures()) {
+        for (const bool anchorMajor : {false, true}) {
+            make_tensor(f, FLOAT, anchorMajor, original);
+            make_tensor(f, HALF, anchorMajor, half);
+            widen_tensor(half, widened);
+            for (const ModeEntry& mode : kModes) {
+                std::vector<NvDsInferParseObjectInfo> fp32, fp16, reference;
+                ok &= mode.fn(original.layers, network, params, fp32);
+                ok &= mode.fn(half.layers, network, params, fp16);
+                ok &= mode.fn(widened.layers, network, params, reference);
+                std::printf("%-12s %-12s %-8s %8zu %8zu\n", f.name.c_str(),
+                            layout_name(anchorMajor), mode.name, fp32.size(), fp16.size());
+                if (fp16.size() != reference.size() ||
+                    std::memcmp(fp16.data(), reference.data(),
+                                fp16.size() * sizeof(NvDsInferParseObjectInfo)) != 0) {
+                    std::fprintf(stderr, "%s/%s/%s: FP16 parse differs from the widened FP32 "
+                                 "parse (%zu vs %zu detections)\n", f.name.c_str(),
+                                 layout_name(anchorMajor), mode.name, fp16.size(),
+                                 reference.size());
+                    ok = false;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+// Steady-state parsing must not touch the heap. One pass over every input
+// (fixture x type x layout x NMS mode) sizes the scratch buffers and the
+// reused object list to their high-water mark; a second pass, in the same
+// order, must then make no allocations at all.
+static bool check_allocations() {
+    const NvDsInferNetworkInfo network{kNetWidth, kNetHeight, 3};
+    const NvDsInferParseDetectionParams params = person_params();
+
+    std::vector<Tensor> tensors;
+    for (const Fixture& f : make_all_fixtures()) {
+        for (const NvDsInferDataType dataType : {FLOAT, HALF}) {
+            for (const bool anchorMajor : {false, true}) {
+                tensors.emplace_back();
+                make_tensor(f, dataType, anchorMajor, tensors.back());
+            }
+        }
+    }
+
+    bool ok = true;
+    std::vector<NvDsInferParseObjectInfo> objects;
+    uint64_t allocs[2] = {0, 0};
+    for (int pass = 0; pass < 2; ++pass) {
+        const uint64_t before = gAllocations.load();
+        for (const Tensor& tensor : tensors) {
+            for (const ModeEntry& mode : kModes) {
+                objects.clear();
+                ok &= mode.fn(tensor.layers, network, params, objects);
+            }
+        }
+        allocs[pass] = gAllocations.load() - before;
+    }
+    const size_t parses = tensors.size() * (sizeof(kModes) / sizeof(kModes[0]));
+    std::printf("%zu parses: %llu allocations while warming up, %llu after\n", parses,
+                static_cast<unsigned long long>(allocs[0]),
+                static_cast<unsigned long long>(allocs[1]));
+    if (allocs[1] != 0) {
+        std::fprintf(stderr, "steady-state parses allocated %llu times\n",
+                     static_cast<unsigned long long>(allocs[1]));
+        ok = false;
+    }
+    return ok;
+}
+
+// nvinfer with batch-size=B runs the network once for B frames, then calls
+// the parser B times: once per frame, with the batch dimension stripped and
+// layer.buffer pointing at that frame's [84, 8400] slice of the batch output.
+// The parser never sees more than one frame, so frames of a batch can only be
+// parsed in parallel by calling it from several threads.
+struct Batch {
+    std::vector<float> f32;  // [B][84][8400], as nvinfer's output buffer
+    std::vector<Half> f16;
+    std::vector<std::vector<NvDsInferLayerInfo>> frames;  // one layer per frame
+};
+
+static void make_batch(const std::vector<Fixture>& fixtures, NvDsInferDataType dataType,
+                       Batch& out) {
+    const size_t frameElems = fixtures[0].tensor.size();
+    out.f32.clear();
+    for (const Fixture& f : fixtures) {
+        out.f32.insert(out.f32.end(), f.tensor.begin(), f.tensor.end());
+    }
+    out.f16.clear();
+    if (dataType == HALF) {
+        out.f16.reserve(out.f32.size());
+        for (const float v : out.f32) {
+            out.f16.push_back(to_half(v));
+        }
+    }
+    out.frames.clear();
+    for (size_t b = 0; b < fixtures.size(); ++b) {
+        NvDsInferLayerInfo layer{};
+        layer.dataType = dataType;
+        layer.inferDims.numDims = 2;
+        layer.inferDims.d[0] = kNumAttrs;
+        layer.inferDims.d[1] = static_cast<unsigned>(fixtures[b].numAnchors);
+        layer.inferDims.numElements = layer.inferDims.d[0] * layer.inferDims.d[1];
+        layer.layerName = "output0";
+        layer.buffer = dataType == HALF ? static_cast<void*>(out.f16.data() + b * frameElems)
+                                        : static_cast<void*>(out.f32.data() + b * frameElems);
+        out.frames.push_back({layer});
+    }
+}
+
+// One long-lived thread per frame. run() hands every thread its frame index
+// and returns when all of them are done; each thread keeps its own parser
+// scratch, as separate nvinfer instances would.
+class FrameThreads {
+public:
+    explicit FrameThreads(int count) {
+        for (int i = 0; i < count; ++i) {
+            threads_.emplace_back([this, i] { loop(i); });
+        }
+    }
+
+    ~FrameThreads() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            ++generation_;
+        }
+        start_.notify_all();
+        for (std::thread& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void run(const std::function<void(int)>& fn) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        fn_ = &fn;
+        pending_ = threads_.size();
+        ++generation_;
+        start_.notify_all();
+        done_.wait(lock, [this] { return pending_ == 0; });
+    }
+
+private:
+    void loop(int index) {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            start_.wait(lock, [&] { return generation_ != seen; });
+            seen = generation_;
+            if (stop_) return;
+            const std::function<void(int)>* fn = fn_;
+            lock.unlock();
+            (*fn)(index);
+            lock.lock();
+            if (--pending_ == 0) done_.notify_one();
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    const std::function<void(int)>* fn_ = nullptr;
+    size_t pending_ = 0;
+    uint64_t generation_ = 0;
+    bool stop_ = false;
+};
+
+static bool run_batch(int iterations) {
+    const int warmup = 3;
+    const NvDsInferNetworkInfo network{kNetWidth, kNetHeight, 3};
+    const NvDsInferParseDetectionParams params = person_params();
+
+    std::printf("%u hardware threads; \"serial\" is what nvinfer does, \"threaded\" parses "
+                "each frame on its own thread\n", std::thread::hardware_concurrency());
+    std::printf("%5s %-5s %14s %16s %8s %8s\n",
+                "batch", "type", "serial ns", "threaded ns", "speedup", "objects");
+    bool ok = true;
+    for (const int frames : {1, 2, 4}) {
+        std::vector<Fixture> fixtures;
+        for (int b = 0; b < frames; ++b) {
+            fixtures.push_back(make_people("camera " + std::to_string(b), 4,
+                                           10 + static_cast<uint32_t>(b)));
+        }
+        for (const NvDsInferDataType dataType : {FLOAT, HALF}) {
+            Batch batch;
+            make_batch(fixtures, dataType, batch);
+            std::vector<std::vector<NvDsInferParseObjectInfo>> objects(frames);
+            std::atomic<bool> parsed{true};
+            auto parse = [&](int b) {
+                objects[b].clear();
+                if (!NvDsInferParseYoloV8(batch.frames[b], network, params, objects[b])) {
+                    parsed = false;
+                }
+            };
+
+            for (int i = 0; i < warmup; ++i) {
+                for (int b = 0; b < frames; ++b) parse(b);
+            }
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i) {
+                for (int b = 0; b < frames; ++b) parse(b);
+            }
+            const double serial = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start).count() / iterations;
+
+            FrameThreads threads(frames);
+            const std::function<void(int)> task = parse;
+            for (int i = 0; i < warmup; ++i) threads.run(task);
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i) threads.run(task);
+            const double threaded = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start).count() / iterations;
+
+            size_t total = 0;
+            for (const auto& list : objects) total += list.size();
+            std::printf("%5d %-5s %14.0f %16.0f %7.2fx %8zu\n", frames,
+                        dataType == HALF ? "fp16" : "fp32", serial, threaded,
+                        serial / threaded, total);
+            ok &= parsed.load();
+        }
+    }
+    return ok;
+}
+
+// A 2-camera config (batch-size=2): each frame of the batch output, parsed
+// on its own thread through its per-frame layer, must give exactly the
+// detections of parsing that camera's tensor alone. Repeated so concurrent
+// parses get a chance to interfere through shared state. A single layer
+// holding both frames ([2, 84, 8400]) is not something nvinfer produces and
+// must be rejected rather than parsed as one frame.
+static bool check_batch() {
+    const NvDsInferNetworkInfo network{kNetWidth, kNetHeight, 3};
+    const NvDsInferParseDetectionParams params = person_params();
+    const std::vector<Fixture> all = make_fixtures();
+    const std::vector<Fixture> cameras = {all[2], all[3]};  // "4 persons", "crowded"
+    const int rounds = 200;
+
+    bool ok = true;
+    FrameThreads threads(static_cast<int>(cameras.size()));
+    for (const NvDsInferDataType dataType : {FLOAT, HALF}) {
+        Batch batch;
+        make_batch(cameras, dataType, batch);
+        for (const ModeEntry& mode : kModes) {
+            std::vector<std::vector<NvDsInferParseObjectInfo>> expected(cameras.size());
+            Tensor tensor;
+            for (size_t b = 0; b < cameras.size(); ++b) {
+                make_tensor(cameras[b], dataType, false, tensor);
+                ok &= mode.fn(tensor.layers, network, params, expected[b]);
+            }
+
+            std::vector<std::vector<NvDsInferParseObjectInfo>> objects(cameras.size());
+            std::atomic<int> mismatches{0};
+            const std::function<void(int)> task = [&](int b) {
+                objects[b].clear();
+                if (!mode.fn(batch.frames[b], network, params, objects[b]) ||
+                    objects[b].size() != expected[b].size() ||
+                    std::memcmp(objects[b].data(), expected[b].data(),
+                                objects[b].size() * sizeof(NvDsInferParseObjectInfo)) != 0) {
+                    mismatches.fetch_add(1);
+                }
+            };
+            for (int i = 0; i < rounds; ++i) {
+                threads.run(task);
+            }
+            std::printf("%-5s %-8s %8zu %8zu %10d\n", dataType == HALF ? "fp16" : "fp32",
+                        mode.name, expected[0].size(), expected[1].size(), mismatches.load());
+            if (mismatches.load() != 0) {
+                std::fprintf(stderr, "%s/%s: %d of %d per-frame parses differ from the "
+                             "single-frame parse\n", dataType == HALF ? "fp16" : "fp32",
+                             mode.name, mismatches.load(), rounds * 2);
+                ok = false;
+            }
+        }
+
+        std::vector<NvDsInferLayerInfo> whole = batch.frames[0];
+        whole[0].inferDims.numDims = 3;
+        whole[0].inferDims.d[2] = whole[0].inferDims.d[1];
+        whole[0].inferDims.d[1] = whole[0].inferDims.d[0];
+        whole[0].inferDims.d[0] = static_cast<unsigned>(cameras.size());
+        whole[0].inferDims.numElements *= static_cast<unsigned>(cameras.size());
+        std::vector<NvDsInferParseObjectInfo> objects;
+        if (NvDsInferParseYoloV8(whole, network, params, objects)) {
+            std::fprintf(stderr, "a [2, 84, 8400] layer was parsed instead of rejected\n");
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static const char* simd_backend() {
+#if defined(YOLOV8_SIMD_NEON)
+    return "neon";
+#elif defined(YOLOV8_SIMD_AVX2)
+    return "avx2";
+#elif defined(YOLOV8_SIMD_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+// Tells FP32 from FP16 by the file size: the element count has to be 84 times
+// the anchor count of a square input (8400 for 640x640)
+static bool load_tensor(const char* path, Tensor& out, NvDsInferNetworkInfo& network) {
+    std::string data;
+    if (std::FILE* file = std::fopen(path, "rb")) {
+        char buf[65536];
+        size_t n;
+        while ((n = std::fread(buf, 1, sizeof(buf), file)) > 0) {
+            data.append(buf, n);
+        }
+        std::fclose(file);
+    } else {
+        std::fprintf(stderr, "cannot read %s\n", path);
+        return false;
+    }
+    for (const NvDsInferDataType dataType : {FLOAT, HALF}) {
+        const size_t elementSize = dataType == HALF ? sizeof(Half) : sizeof(float);
+        if (data.size() % (kNumAttrs * elementSize) != 0) continue;
+        const size_t anchors = data.size() / (kNumAttrs * elementSize);
+        for (unsigned size = 32; size <= 2048; size += 32) {
+            if (static_cast<size_t>(expected_anchors(size, size)) != anchors) continue;
+            out.f32.clear();
+            out.f16.clear();
+            void* buffer;
+            if (dataType == HALF) {
+                out.f16.resize(data.size() / elementSize);
+                std::memcpy(out.f16.data(), data.data(), data.size());
+                buffer = out.f16.data();
+            } else {
+                out.f32.resize(data.size() / elementSize);
+                std::memcpy(out.f32.data(), data.data(), data.size());
+                buffer = out.f32.data();
+            }
+            NvDsInferLayerInfo layer{};
+            layer.dataType = dataType;
+            layer.inferDims.numDims = 2;
+            layer.inferDims.d[0] = kNumAttrs;
+            layer.inferDims.d[1] = static_cast<unsigned>(anchors);
+            layer.inferDims.numElements = layer.inferDims.d[0] * layer.inferDims.d[1];
+            layer.layerName = "output0";
+            layer.buffer = buffer;
+            out.layers.assign(1, layer);
+            network = NvDsInferNetworkInfo{size, size, 3};
+            return true;
+        }
+    }
+    std::fprintf(stderr, "%s: %zu bytes is not an [%d][N] FP32/FP16 tensor of a square input\n",
+                 path, data.size(), kNumAttrs);
+    return false;
+}
+
+struct TensorDetection {
+    std::string mode;
+    unsigned classId;
+    float left, top, width, height, confidence;
+};
+
+static bool parse_recorded(const Tensor& tensor, const NvDsInferNetworkInfo& network,
+                           std::vector<TensorDetection>& out) {
+    const NvDsInferParseDetectionParams params = person_params();
+    bool ok = true;
+    for (const ModeEntry& mode : kModes) {
+        std::vector<NvDsInferParseObjectInfo> objects;
+        ok &= mode.fn(tensor.layers, network, params, objects);
+        for (const auto& o : objects) {
+            out.push_back({mode.name, o.classId, o.left, o.top, o.width, o.height,
+                           o.detectionConfidence});
+        }
+    }
+    return ok;
+}
+
+static bool read_expected(const char* path, std::vector<TensorDetection>& out) {
+    std::FILE* file = std::fopen(path, "r");
+    if (!file) {
+        std::fprintf(stderr, "cannot read %s\n", path);
+        return false;
+    }
+    char line[256];
+    while (std::fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        char mode[16];
+        TensorDetection d;
+        if (std::sscanf(line, "%15s %u %f %f %f %f %f", mode, &d.classId, &d.left, &d.top,
+                        &d.width, &d.height, &d.confidence) != 7) {
+            std::fprintf(stderr, "%s: bad line: %s", path, line);
+            std::fclose(file);
+            return false;
+        }
+        d.mode = mode;
+        out.push_back(d);
+    }
+    std::fclose(file);
+    return true;
+}
+
+static bool check_tensor(const char* tensorPath, const char* expectedPath) {
+    Tensor tensor;
+    NvDsInferNetworkInfo network{};
+    std::vector<TensorDetection> actual;
+    if (!load_tensor(tensorPath, tensor, network) || !parse_recorded(tensor, network, actual)) {
+        return false;
+    }
+    if (!expectedPath) {
+        std::printf("# %s: %s %ux%u\n", tensorPath,
+                    tensor.layers[0].dataType == HALF ? "fp16" : "fp32", network.width,
+                    network.height);
+        std::printf("# nms class left top width height confidence\n");
+        for (const TensorDetection& d : actual) {
+            std::printf("%s %u %.3f %.3f %.3f %.3f %.6f\n", d.mode.c_str(), d.classId, d.left,
+                        d.top, d.width, d.height, d.confidence);
+        }
+        return true;
+    }
+
+    std::vector<TensorDetection> expected;
+    if (!read_expected(expectedPath, expected)) {
+        return false;
+    }
+    auto near = [](float a, float b, float tolerance) { return std::fabs(a - b) <= tolerance; };
+    bool ok = actual.size() == expected.size();
+    for (size_t i = 0; ok && i < actual.size(); ++i) {
+        const TensorDetection& a = actual[i];
+        const TensorDetection& e = expected[i];
+        if (a.mode != e.mode || a.classId != e.classId || !near(a.left, e.left, 0.01f) ||
+            !near(a.top, e.top, 0.01f) || !near(a.width, e.width, 0.01f) ||
+            !near(a.height, e.height, 0.01f) || !near(a.confidence, e.confidence, 1e-4f)) {
+            std::fprintf(stderr, "detection %zu differs: got %s %u %.3f %.3f %.3f %.3f %.6f, "
+                         "expected %s %u %.3f %.3f %.3f %.3f %.6f\n", i, a.mode.c_str(),
+                         a.classId, a.left, a.top, a.width, a.height, a.confidence,
+                         e.mode.c_str(), e.classId, e.left, e.top, e.width, e.height,
+                         e.confidence);
+            ok = false;
+        }
+    }
+    if (actual.size() != expected.size()) {
+        std::fprintf(stderr, "%zu detections, %s expects %zu\n", actual.size(), expectedPath,
+                     expected.size());
+    }
+    if (ok) {
+        std::printf("%s: %zu detections match %s\n", simd_backend(), actual.size(),
+                    expectedPath);
+    }
+    return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const std::string arg = argc > 1 ? argv[1] : "";
+    if (arg == "--tensor" && argc > 2) {
+        if (!check_tensor(argv[2], argc > 3 ? argv[3] : nullptr)) {
+            std::fprintf(stderr, "FAILED\n");
+            return 1;
+        }
+        return 0;
+    }
+    if (arg == "--batch") {
+        const int iterations = argc > 2 ? std::max(1, std::atoi(argv[2])) : 200;
+        if (!run_batch(iterations)) {
+            std::fprintf(stderr, "FAILED\n");
+            return 1;
+        }
+        return 0;
+    }
+    if (arg == "--batch-check") {
+        std::printf("%-5s %-8s %8s %8s %10s\n", "type", "nms", "camera 0", "camera 1",
+                    "mismatches");
+        if (!check_batch()) {
+            std::fprintf(stderr, "FAILED\n");
+            return 1;
+        }
+        return 0;
+    }
+    if (arg == "--fp16" || arg == "--allocations") {
+        if (!(arg == "--fp16" ? check_fp16() : check_allocations())) {
+            std::fprintf(stderr, "FAILED\n");
+            return 1;
+        }
+        return 0;
+    }
+    if ((arg == "--dump" || arg == "--compare") && argc > 2) {
+#if defined(__x86_64__) && defined(__AVX2__)
+        if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("f16c")) {
+            std::printf("CPU lacks AVX2/F16C, skipping\n");
+            return 77;
+        }
+#endif
+        std::string out;
+        if (!dump_outputs(out)) {
+            std::fprintf(stderr, "parse failed\n");
+            return 1;
+        }
+        if (arg == "--dump") {
+            std::FILE* file = std::fopen(argv[2], "wb");
+            if (!file || std::fwrite(out.data(), 1, out.size(), file) != out.size()) {
+                std::fprintf(stderr, "cannot write %s\n", argv[2]);
+                return 1;
+            }
+            std::fclose(file);
+            std::printf("%s: wrote %zu bytes\n", simd_backend(), out.size());
+            return 0;
+        }
+        std::string expected;
+        if (std::FILE* file = std::fopen(argv[2], "rb")) {
+            char buf[65536];
+            size_t n;
+            while ((n = std::fread(buf, 1, sizeof(buf), file)) > 0) {
+                expected.append(buf, n);
+            }
+            std::fclose(file);
+        }
+        if (out != expected) {
+            size_t i = 0;
+            while (i < out.size() && i < expected.size() && out[i] == expected[i]) ++i;
+            std::fprintf(stderr, "%s: output differs from %s at byte %zu (%zu vs %zu bytes)\n",
+                         simd_backend(), argv[2], i, out.size(), expected.size());
+            return 1;
+        }
+        std::printf("%s: %zu bytes identical to %s\n", simd_backend(), out.size(), argv[2]);
+        return 0;
+    }
+
+    const int iterations = argc > 1 ? std::max(1, std::atoi(argv[1])) : 200;
+    if (!run_benchmark(iterations)) {
+        std::fprintf(stderr, "FAILED\n");
+        return 1;
+    }
+    return 0;
+}